@@ -0,0 +1,378 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <random>
+#include <unordered_map>
+#include <vector>
+
+#include "FlatMap.h"
+#include "LevelMath.h"
+#include "ReferenceStats.h"
+
+#ifdef EREZ_BENCH_LOGGING
+#include <spdlog/async.h>
+#include <spdlog/sinks/basic_file_sink.h>
+#include <spdlog/spdlog.h>
+#endif
+
+// Synthetic benchmarks of the leveling math and the data structures of the relevel path
+// Usage: Bench [name] [iterations]
+namespace {
+    using namespace EREZ;
+
+    template <typename Func>
+    void Run(const char* name, std::size_t calls, int iterations, Func&& func) {
+        std::uint64_t checksum = 0;
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < iterations; ++i) {
+            checksum = checksum * 31 + func();
+        }
+        auto nanoseconds =
+            std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+        auto total = static_cast<double>(calls) * iterations;
+        std::printf("%-28s %10zu calls %10.2f ns per call   checksum %016llx\n", name, calls, nanoseconds / total,
+                    static_cast<unsigned long long>(checksum));
+    }
+
+    // FormIDs of npc records in a large load order: the base game and DLC masters, regular plugins and light plugins
+    std::vector<std::uint32_t> MakeNpcFormIDs(std::mt19937& random) {
+        std::vector<std::uint32_t> formIDs;
+        auto addPlugin = [&](std::uint32_t prefix, std::uint32_t firstID, std::uint32_t lastID, std::size_t count) {
+            std::uniform_int_distribution<std::uint32_t> objectID(firstID, lastID);
+            for (std::size_t i = 0; i < count; ++i) {
+                formIDs.push_back(prefix | objectID(random));
+            }
+        };
+        addPlugin(0x00000000, 0x000007, 0x10ffff, 5200);
+        addPlugin(0x02000000, 0x000800, 0x01ffff, 900);
+        addPlugin(0x03000000, 0x000800, 0x00ffff, 30);
+        addPlugin(0x04000000, 0x000800, 0x03ffff, 1000);
+        std::uniform_int_distribution<std::size_t> pluginNpcs(0, 150);
+        for (std::uint32_t index = 0x05; index < 0xfe; ++index) {
+            addPlugin(index << 24, 0x000800, 0x0fffff, pluginNpcs(random));
+        }
+        std::uniform_int_distribution<std::size_t> lightPluginNpcs(0, 20);
+        for (std::uint32_t lightIndex = 0; lightIndex < 1000; ++lightIndex) {
+            addPlugin(0xfe000000 | lightIndex << 12, 0x800, 0xfff, lightPluginNpcs(random));
+        }
+        std::sort(formIDs.begin(), formIDs.end());
+        formIDs.erase(std::unique(formIDs.begin(), formIDs.end()), formIDs.end());
+        return formIDs;
+    }
+
+    // Original level lookup of NpcTable: FormID index, binary search and the unordered_map it replaced
+    void BenchNpcTable(int iterations) {
+        std::mt19937 random(4);
+        auto formIDs = MakeNpcFormIDs(random);
+        std::vector<std::uint16_t> originalMin(formIDs.size());
+        std::vector<std::uint16_t> originalMax(formIDs.size());
+        struct actorbaseData {
+            std::uint16_t originalMin;
+            std::uint16_t originalMax;
+        };
+        std::unordered_map<std::uint32_t, actorbaseData> originalActorBaseLevels;
+        FlatMap<std::uint32_t, std::uint32_t> index(formIDs.size());
+        std::uniform_int_distribution<int> level(1, 81);
+        for (std::size_t i = 0; i < formIDs.size(); ++i) {
+            originalMin[i] = static_cast<std::uint16_t>(level(random));
+            originalMax[i] = static_cast<std::uint16_t>(level(random));
+            originalActorBaseLevels.emplace(formIDs[i], actorbaseData{originalMin[i], originalMax[i]});
+            index.InsertOrAssign(formIDs[i], static_cast<std::uint32_t>(i));
+        }
+
+        // actors mostly use records of the base game and large plugins, some lookups miss
+        std::vector<std::uint32_t> lookups(1 << 20);
+        std::uniform_int_distribution<std::size_t> record(0, formIDs.size() - 1);
+        std::uniform_int_distribution<std::uint32_t> miss(0, 0xfdffffff);
+        std::uniform_int_distribution<int> percent(0, 99);
+        for (auto& lookup : lookups) {
+            lookup = percent(random) < 95 ? formIDs[record(random)] : miss(random);
+        }
+
+        auto arrays = formIDs.size() * (sizeof(std::uint32_t) + 2 * sizeof(std::uint16_t));
+        auto nodes = originalActorBaseLevels.size() * (sizeof(std::uint32_t) + sizeof(actorbaseData) + sizeof(void*)) +
+                     originalActorBaseLevels.bucket_count() * sizeof(void*);
+        std::printf("%zu npc records: arrays %zu KiB, index %zu KiB, unordered_map at least %zu KiB\n", formIDs.size(),
+                    arrays / 1024, index.MemoryUsage() / 1024, nodes / 1024);
+        Run("npc table index", lookups.size(), iterations, [&]() {
+            std::uint64_t sum = 0;
+            for (auto formID : lookups) {
+                if (auto i = index.Find(formID)) {
+                    sum += originalMin[*i] + originalMax[*i];
+                }
+            }
+            return sum;
+        });
+        Run("npc table binary search", lookups.size(), iterations, [&]() {
+            std::uint64_t sum = 0;
+            for (auto formID : lookups) {
+                auto it = std::lower_bound(formIDs.begin(), formIDs.end(), formID);
+                if (it != formIDs.end() && *it == formID) {
+                    auto i = it - formIDs.begin();
+                    sum += originalMin[i] + originalMax[i];
+                }
+            }
+            return sum;
+        });
+        Run("npc table unordered_map", lookups.size(), iterations, [&]() {
+            std::uint64_t sum = 0;
+            for (auto formID : lookups) {
+                auto it = originalActorBaseLevels.find(formID);
+                if (it != originalActorBaseLevels.end()) {
+                    sum += it->second.originalMin + it->second.originalMax;
+                }
+            }
+            return sum;
+        });
+    }
+
+    // Level range of one npc per call, as the relevel path computes it, over random zone and original ranges
+    void BenchLevelRange(int iterations) {
+        std::mt19937 random(5);
+        std::uniform_int_distribution<int> level(1, 81);
+        std::uniform_int_distribution<int> playerLevelMult(500, 2000);
+        std::vector<LevelRangeInput> inputs(1 << 16);
+        for (std::size_t i = 0; i < inputs.size(); ++i) {
+            auto& input = inputs[i];
+            input.minLevel = static_cast<std::uint16_t>(level(random));
+            input.maxLevel = static_cast<std::uint16_t>(i % 4 == 0 ? 0 : input.minLevel + level(random));
+            input.originalMin = static_cast<std::uint16_t>(level(random));
+            input.originalMax = static_cast<std::uint16_t>(i % 3 == 0 ? 0 : input.originalMin + level(random));
+            input.level = static_cast<std::uint16_t>(playerLevelMult(random));
+            input.includeLevelMult = i % 2 == 0;
+        }
+        Run("level range", inputs.size(), iterations * 16, [&]() {
+            std::uint64_t sum = 0;
+            for (const auto& input : inputs) {
+                auto range = ComputeLevelRange(input);
+                sum += range.min * 131 + range.max;
+            }
+            return sum;
+        });
+    }
+
+    // Batched level ranges of 10k to 100k npcs, vector path against a scalar loop over the same arrays
+    void BenchLevelRanges(int iterations) {
+        std::mt19937 random(6);
+        std::uniform_int_distribution<int> level(1, 81);
+        std::uniform_int_distribution<int> playerLevelMult(500, 2000);
+        for (std::size_t count : {10000, 50000, 100000}) {
+            std::vector<std::uint16_t> minLevel(count), maxLevel(count), originalMin(count), originalMax(count),
+                levels(count), outMin(count), outMax(count);
+            for (std::size_t i = 0; i < count; ++i) {
+                minLevel[i] = static_cast<std::uint16_t>(level(random));
+                maxLevel[i] = static_cast<std::uint16_t>(i % 4 == 0 ? 0 : minLevel[i] + level(random));
+                originalMin[i] = static_cast<std::uint16_t>(level(random));
+                originalMax[i] = static_cast<std::uint16_t>(i % 3 == 0 ? 0 : originalMin[i] + level(random));
+                levels[i] = static_cast<std::uint16_t>(playerLevelMult(random));
+            }
+            LevelRangeBatch batch;
+            batch.minLevel = minLevel.data();
+            batch.maxLevel = maxLevel.data();
+            batch.originalMin = originalMin.data();
+            batch.originalMax = originalMax.data();
+            batch.level = levels.data();
+            batch.count = count;
+            batch.includeLevelMult = true;
+            auto checksum = [&]() {
+                std::uint64_t sum = 0;
+                for (std::size_t i = 0; i < count; i += 97) {
+                    sum = sum * 131 + outMin[i] * 257 + outMax[i];
+                }
+                return sum;
+            };
+
+            char name[64];
+            std::snprintf(name, sizeof(name), "level ranges %zu", count);
+            Run(name, count, iterations * 10, [&]() {
+                ComputeLevelRanges(batch, outMin.data(), outMax.data());
+                return checksum();
+            });
+            std::snprintf(name, sizeof(name), "level ranges %zu scalar", count);
+            Run(name, count, iterations * 10, [&]() {
+                for (std::size_t i = 0; i < count; ++i) {
+                    LevelRangeInput input;
+                    input.minLevel = minLevel[i];
+                    input.maxLevel = maxLevel[i];
+                    input.originalMin = originalMin[i];
+                    input.originalMax = originalMax[i];
+                    input.level = levels[i];
+                    input.includeLevelMult = true;
+                    auto range = ComputeLevelRange(input);
+                    outMin[i] = range.min;
+                    outMax[i] = range.max;
+                }
+                return checksum();
+            });
+        }
+    }
+
+    // Attribute calculation for every combination of attribute weights up to 5 at levels 1-100, against the list
+    // based reference it replaced
+    void BenchAttributes(int iterations) {
+        std::vector<AttributeInput> inputs;
+        for (int health = 1; health <= 5; ++health) {
+            for (int magicka = 0; magicka <= 5; ++magicka) {
+                for (int stamina = 1; stamina <= 5; ++stamina) {
+                    for (std::uint16_t level = 1; level <= 100; ++level) {
+                        AttributeInput input;
+                        input.level = level;
+                        input.weights = {static_cast<std::uint8_t>(health), static_cast<std::uint8_t>(magicka),
+                                         static_cast<std::uint8_t>(stamina)};
+                        input.offsets = {10, 0, -5};
+                        input.raceStartingValues = {50.0f, 50.0f, 50.0f};
+                        inputs.push_back(input);
+                    }
+                }
+            }
+        }
+
+        StatConstants constants = {10, 5, 5, 15};
+        // the health and stamina of the reference are the same, its magicka divides by 0 for magicka weight 0
+        auto hash = [](const std::array<std::int64_t, numAttributes>& attributes) {
+            return static_cast<std::uint64_t>(attributes[0] * 131 + attributes[2]);
+        };
+        Run("attributes", inputs.size(), iterations * 10, [&]() {
+            std::uint64_t sum = 0;
+            for (const auto& input : inputs) {
+                sum += hash(CalculateAttributes(input, constants));
+            }
+            return sum;
+        });
+        Run("attributes list reference", inputs.size(), iterations * 10, [&]() {
+            std::uint64_t sum = 0;
+            for (const auto& input : inputs) {
+                sum += hash(Test::ReferenceAttributes(input, constants));
+            }
+            return sum;
+        });
+    }
+
+    // Skill calculation for every combination of class and race weights at levels 1-100, against the list based
+    // reference it replaced. The classes and races are synthetic, with the number and shape of the vanilla ones
+    void BenchSkills(int iterations) {
+        std::mt19937 random(8);
+        std::uniform_int_distribution<int> weight(0, 6);
+        std::vector<std::array<std::uint8_t, numSkills>> classes(70);
+        for (auto& skillWeights : classes) {
+            for (auto& w : skillWeights) {
+                w = static_cast<std::uint8_t>(weight(random) <= 2 ? 0 : weight(random));
+            }
+        }
+        std::vector<std::array<SkillBoost, numSkillBoosts>> races(10);
+        std::uniform_int_distribution<std::int32_t> skill(0, numSkills - 1);
+        for (auto& boosts : races) {
+            for (std::size_t i = 0; i < numSkillBoosts; ++i) {
+                boosts[i] = SkillBoost{firstSkillActorValue + skill(random), i == 0 ? 10 : 5};
+            }
+        }
+        std::vector<SkillInput> inputs;
+        for (const auto& skillWeights : classes) {
+            for (const auto& boosts : races) {
+                for (std::uint16_t level = 1; level <= 100; ++level) {
+                    inputs.push_back(SkillInput{level, skillWeights, boosts});
+                }
+            }
+        }
+
+        StatConstants constants = {10, 5, 5, 15};
+        auto hash = [](const std::array<std::uint8_t, numSkills>& skills) {
+            std::uint64_t result = 0;
+            for (auto value : skills) {
+                result = result * 131 + value;
+            }
+            return result;
+        };
+        Run("skills", inputs.size(), iterations, [&]() {
+            std::uint64_t sum = 0;
+            for (const auto& input : inputs) {
+                sum += hash(CalculateSkills(input, constants));
+            }
+            return sum;
+        });
+        Run("skills list reference", inputs.size(), iterations, [&]() {
+            std::uint64_t sum = 0;
+            for (const auto& input : inputs) {
+                sum += hash(Test::ReferenceSkills(input, constants));
+            }
+            return sum;
+        });
+    }
+
+#ifdef EREZ_BENCH_LOGGING
+    // Time per trace message on the logging thread, with the file sink called directly and through the asynchronous
+    // logger of bAsyncLogging. The asynchronous queue blocks or drops messages when the writer cannot keep up.
+    void BenchLogging(int iterations) {
+        constexpr std::size_t calls = 20000;
+        auto path = std::filesystem::temp_directory_path() / "EnemiesRespectEncounterZonesBench.log";
+        auto sink = std::make_shared<spdlog::sinks::basic_file_sink_mt>(path.string(), true);
+        sink->set_pattern("[%Y-%m-%d %H:%M:%S.%e] [%n] [%l] [%t] %v");
+        auto logMessages = [&](spdlog::logger& log) {
+            for (std::uint32_t i = 0; i < calls; ++i) {
+                log.trace("Releveling reference [{:X}]({}).   {}", 0xff000800 + i, "Bandit Marauder", "CellAttach");
+            }
+            return calls;
+        };
+
+        // without bAsyncLogging, every message at the log level is flushed
+        spdlog::logger syncLog("Global", sink);
+        syncLog.set_level(spdlog::level::trace);
+        syncLog.flush_on(spdlog::level::trace);
+        Run("log file sink", calls, iterations, [&]() { return logMessages(syncLog); });
+        syncLog.flush_on(spdlog::level::off);
+        Run("log file sink, no flush", calls, iterations, [&]() { return logMessages(syncLog); });
+
+        auto policies = {std::pair{"log async block", spdlog::async_overflow_policy::block},
+                         std::pair{"log async overrun oldest", spdlog::async_overflow_policy::overrun_oldest}};
+        for (auto [name, policy] : policies) {
+            auto threadPool = std::make_shared<spdlog::details::thread_pool>(8192, 1);
+            {
+                // the asynchronous logger posts itself to the queue, so it has to be owned by a shared_ptr
+                auto asyncLog = std::make_shared<spdlog::async_logger>("Global", sink, threadPool, policy);
+                asyncLog->set_level(spdlog::level::trace);
+                Run(name, calls, iterations, [&]() { return logMessages(*asyncLog); });
+            }
+            auto dropped = threadPool->overrun_counter();
+            // the pool waits for the queued messages when it is destroyed
+            auto start = std::chrono::steady_clock::now();
+            threadPool.reset();
+            auto drain =
+                std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+            std::printf("%-28s %zu dropped, %lld us to drain the queue\n", "", dropped,
+                        static_cast<long long>(drain.count()));
+        }
+        std::filesystem::remove(path);
+    }
+#endif
+
+    struct Benchmark {
+        const char* name;
+        void (*run)(int iterations);
+    };
+
+    constexpr Benchmark benchmarks[] = {
+        {"npctable", BenchNpcTable},
+        {"levelrange", BenchLevelRange},
+        {"levelranges", BenchLevelRanges},
+        {"attributes", BenchAttributes},
+        {"skills", BenchSkills},
+#ifdef EREZ_BENCH_LOGGING
+        {"logging", BenchLogging},
+#endif
+    };
+}  // namespace
+
+int main(int argc, char** argv) {
+    const char* filter = argc > 1 ? argv[1] : nullptr;
+    int iterations = argc > 2 ? std::max(std::atoi(argv[2]), 1) : 10;
+    for (const auto& benchmark : benchmarks) {
+        if (!filter || std::strcmp(filter, "all") == 0 || std::strcmp(filter, benchmark.name) == 0) {
+            benchmark.run(iterations);
+        }
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <stdint.h>
+
+// C interface for other SKSE plugins
+// Relevel messages: listen to the sender EREZ_PLUGIN_NAME. The data of EREZ_MESSAGE_RELEVEL_BATCH_V1 is an array of
+// EREZ_RelevelRecord, owned by this plugin and only valid until the listener returns
+// Functions: look them up with GetProcAddress after kPostLoad and check EREZ_GetApiVersion first
+// A layout is never changed within a version, a new layout gets a new version and message type
+
+#define EREZ_API_VERSION 1
+#define EREZ_PLUGIN_NAME "EnemiesRespectEncounterZones"
+
+#define EREZ_MESSAGE_RELEVEL_BATCH_V1 1
+
+#if defined(_WIN32) && defined(EREZ_EXPORTS)
+#define EREZ_API __declspec(dllexport)
+#elif defined(_WIN32)
+#define EREZ_API __declspec(dllimport)
+#else
+#define EREZ_API
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Level range change of one actor. zoneFormID is 0 without encounter zone, a max level of 0 is unbounded
+typedef struct EREZ_RelevelRecord {
+    uint32_t actorHandle;
+    uint32_t baseFormID;
+    uint32_t zoneFormID;
+    uint16_t oldMin;
+    uint16_t oldMax;
+    uint16_t newMin;
+    uint16_t newMax;
+} EREZ_RelevelRecord;
+
+// minLevel/maxLevel are the encounter zone range, the others are the npc record values and the level settings
+typedef struct EREZ_LevelRangeInput {
+    uint16_t minLevel;
+    uint16_t maxLevel;
+    uint16_t originalMin;
+    uint16_t originalMax;
+    uint16_t level;
+    uint8_t includeLevelMult;
+    uint8_t extendLevels;
+} EREZ_LevelRangeInput;
+
+typedef struct EREZ_LevelRange {
+    uint16_t min;
+    uint16_t max;
+} EREZ_LevelRange;
+
+EREZ_API uint32_t EREZ_GetApiVersion(void);
+
+// Calculates the level range of an npc record in an encounter zone.
+EREZ_API void EREZ_ComputeLevelRange(const EREZ_LevelRangeInput* input, EREZ_LevelRange* output);
+
+// Calculates count level ranges at once.
+EREZ_API void EREZ_ComputeLevelRanges(const EREZ_LevelRangeInput* inputs, EREZ_LevelRange* outputs, uint32_t count);
+
+typedef uint32_t (*EREZ_GetApiVersion_t)(void);
+typedef void (*EREZ_ComputeLevelRange_t)(const EREZ_LevelRangeInput* input, EREZ_LevelRange* output);
+typedef void (*EREZ_ComputeLevelRanges_t)(const EREZ_LevelRangeInput* inputs, EREZ_LevelRange* outputs,
+                                          uint32_t count);
+
+#ifdef __cplusplus
+}
+#endif
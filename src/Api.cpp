@@ -0,0 +1,103 @@
+#include "EREZ/API.h"
+
+#include <algorithm>
+#include <cstddef>
+
+#include "LevelMath.h"
+
+namespace {
+    // Converts the input of the C interface and normalizes the ranges like the plugin does before releveling.
+    EREZ::LevelRangeInput ToLevelRangeInput(const EREZ_LevelRangeInput& input) {
+        EREZ::LevelRangeInput result;
+        result.minLevel = input.minLevel < 1 ? 1 : input.minLevel;
+        result.maxLevel = input.maxLevel;
+        if (result.minLevel > result.maxLevel && result.maxLevel != 0) {
+            result.maxLevel = result.minLevel;
+        }
+        result.originalMin = input.originalMin;
+        result.originalMax = input.originalMax;
+        if (result.originalMin > result.originalMax && result.originalMax != 0) {
+            result.originalMax = result.originalMin;
+        }
+        result.level = input.level;
+        result.includeLevelMult = input.includeLevelMult != 0;
+        result.extendLevels = input.extendLevels != 0;
+        return result;
+    }
+
+    int GetFlags(const EREZ_LevelRangeInput& input) {
+        return (input.includeLevelMult != 0 ? 1 : 0) | (input.extendLevels != 0 ? 2 : 0);
+    }
+
+    // Inputs with the same flags, gathered into the arrays of the batch calculation. Small enough for the stack.
+    struct LevelRangeChunk {
+        static constexpr std::size_t capacity = 256;
+
+        std::uint16_t minLevel[capacity];
+        std::uint16_t maxLevel[capacity];
+        std::uint16_t originalMin[capacity];
+        std::uint16_t originalMax[capacity];
+        std::uint16_t level[capacity];
+        std::uint16_t outMin[capacity];
+        std::uint16_t outMax[capacity];
+        std::uint32_t index[capacity];
+        std::size_t count = 0;
+
+        void Add(std::uint32_t i, const EREZ::LevelRangeInput& input) {
+            minLevel[count] = input.minLevel;
+            maxLevel[count] = input.maxLevel;
+            originalMin[count] = input.originalMin;
+            originalMax[count] = input.originalMax;
+            level[count] = input.level;
+            index[count] = i;
+            count++;
+        }
+
+        void Compute(int flags, EREZ_LevelRange* outputs) {
+            if (count == 0) {
+                return;
+            }
+            EREZ::LevelRangeBatch batch;
+            batch.minLevel = minLevel;
+            batch.maxLevel = maxLevel;
+            batch.originalMin = originalMin;
+            batch.originalMax = originalMax;
+            batch.level = level;
+            batch.count = count;
+            batch.includeLevelMult = flags & 1;
+            batch.extendLevels = flags & 2;
+            EREZ::ComputeLevelRanges(batch, outMin, outMax);
+            for (std::size_t k = 0; k < count; ++k) {
+                outputs[index[k]].min = outMin[k];
+                outputs[index[k]].max = outMax[k];
+            }
+            count = 0;
+        }
+    };
+}  // namespace
+
+extern "C" {
+EREZ_API uint32_t EREZ_GetApiVersion(void) { return EREZ_API_VERSION; }
+
+EREZ_API void EREZ_ComputeLevelRange(const EREZ_LevelRangeInput* input, EREZ_LevelRange* output) {
+    auto range = EREZ::ComputeLevelRange(ToLevelRangeInput(*input));
+    output->min = range.min;
+    output->max = range.max;
+}
+
+// The flags are per input, but the batch calculation takes them per batch, so each chunk of inputs is split by flags
+EREZ_API void EREZ_ComputeLevelRanges(const EREZ_LevelRangeInput* inputs, EREZ_LevelRange* outputs, uint32_t count) {
+    LevelRangeChunk chunk;
+    for (uint32_t start = 0; start < count; start += LevelRangeChunk::capacity) {
+        auto end = std::min<uint32_t>(count, start + LevelRangeChunk::capacity);
+        for (int flags = 0; flags < 4; ++flags) {
+            for (uint32_t i = start; i < end; ++i) {
+                if (GetFlags(inputs[i]) == flags) {
+                    chunk.Add(i, ToLevelRangeInput(inputs[i]));
+                }
+            }
+            chunk.Compute(flags, outputs);
+        }
+    }
+}
+}
@@ -0,0 +1,152 @@
+#pragma once
+
+#include <algorithm>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace EREZ {
+    // Open addressing hash map with linear probing for integer and pointer keys. Key{} marks empty slots, so it cannot
+    // be inserted. Clear keeps the capacity, so a reused map stops allocating once it has grown to its working size.
+    template <typename Key, typename Value>
+    class FlatMap {
+        static_assert(std::is_integral_v<Key> || std::is_pointer_v<Key>);
+
+    public:
+        explicit FlatMap(std::size_t count = 8) { Rehash(CapacityFor(count)); }
+
+        [[nodiscard]] Value* Find(Key key) {
+            if (key == Key{}) {
+                return nullptr;
+            }
+            for (auto i = Home(key);; i = (i + 1) & mask) {
+                if (slots[i].key == key) {
+                    return &slots[i].value;
+                }
+                if (slots[i].key == Key{}) {
+                    return nullptr;
+                }
+            }
+        }
+
+        [[nodiscard]] const Value* Find(Key key) const { return const_cast<FlatMap*>(this)->Find(key); }
+
+        // returns the value of the key, which is value-initialized if it was inserted
+        std::pair<Value*, bool> TryEmplace(Key key) {
+            auto i = Home(key);
+            for (; slots[i].key != Key{}; i = (i + 1) & mask) {
+                if (slots[i].key == key) {
+                    return {&slots[i].value, false};
+                }
+            }
+            // only grow for new keys, so a full map can still update its entries
+            if ((size + 1) * 2 > slots.size()) {
+                Rehash(slots.size() * 2);
+                i = Home(key);
+                while (slots[i].key != Key{}) {
+                    i = (i + 1) & mask;
+                }
+            }
+            slots[i].key = key;
+            slots[i].value = Value{};
+            size++;
+            return {&slots[i].value, true};
+        }
+
+        void InsertOrAssign(Key key, const Value& value) { *TryEmplace(key).first = value; }
+
+        bool Erase(Key key) {
+            if (key == Key{}) {
+                return false;
+            }
+            auto i = Home(key);
+            for (; slots[i].key != key; i = (i + 1) & mask) {
+                if (slots[i].key == Key{}) {
+                    return false;
+                }
+            }
+            // move following entries of the probe sequence back, so no tombstones are needed
+            for (auto j = (i + 1) & mask; slots[j].key != Key{}; j = (j + 1) & mask) {
+                auto home = Home(slots[j].key);
+                if (((j - home) & mask) >= ((j - i) & mask)) {
+                    slots[i] = slots[j];
+                    i = j;
+                }
+            }
+            slots[i].key = Key{};
+            size--;
+            return true;
+        }
+
+        void Clear() {
+            if (size == 0) {
+                return;
+            }
+            for (auto& slot : slots) {
+                slot.key = Key{};
+            }
+            size = 0;
+        }
+
+        void Reserve(std::size_t count) {
+            auto capacity = CapacityFor(count);
+            if (capacity > slots.size()) {
+                Rehash(capacity);
+            }
+        }
+
+        [[nodiscard]] std::size_t Size() const { return size; }
+        [[nodiscard]] bool Empty() const { return size == 0; }
+        [[nodiscard]] std::size_t MemoryUsage() const { return sizeof(*this) + slots.capacity() * sizeof(Slot); }
+
+        template <typename Func>
+        void ForEach(Func&& func) const {
+            for (const auto& slot : slots) {
+                if (slot.key != Key{}) {
+                    func(slot.key, slot.value);
+                }
+            }
+        }
+
+    private:
+        struct Slot {
+            Key key{};
+            Value value{};
+        };
+
+        std::vector<Slot> slots;
+        std::size_t mask = 0;
+        int shift = 0;
+        std::size_t size = 0;
+
+        // at most half of the slots are used
+        static std::size_t CapacityFor(std::size_t count) { return std::bit_ceil(std::max<std::size_t>(count * 2, 8)); }
+
+        // fibonacci hashing, the upper bits of the product are used
+        [[nodiscard]] std::size_t Home(Key key) const {
+            std::uint64_t bits;
+            if constexpr (std::is_pointer_v<Key>) {
+                bits = reinterpret_cast<std::uintptr_t>(key);
+            } else {
+                bits = static_cast<std::uint64_t>(key);
+            }
+            return static_cast<std::size_t>((bits * 0x9e3779b97f4a7c15ull) >> shift);
+        }
+
+        void Rehash(std::size_t capacity) {
+            std::vector<Slot> previous(capacity);
+            previous.swap(slots);
+            mask = capacity - 1;
+            shift = 64 - std::countr_zero(capacity);
+            size = 0;
+            for (const auto& slot : previous) {
+                if (slot.key != Key{}) {
+                    *TryEmplace(slot.key).first = slot.value;
+                }
+            }
+        }
+    };
+}  // namespace EREZ
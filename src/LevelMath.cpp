@@ -0,0 +1,363 @@
+#include "LevelMath.h"
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define EREZ_LEVEL_RANGES_AVX2
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define EREZ_LEVEL_RANGES_SSE2
+#endif
+
+namespace EREZ {
+    LevelRange ComputeLevelRange(const LevelRangeInput& input) {
+        auto originalMin = input.originalMin;
+        auto originalMax = input.originalMax;
+
+        // use float for calculations
+        float minTmp = input.minLevel;
+        float maxTmp = input.maxLevel;
+
+        // player mult
+        if (input.includeLevelMult) {
+            float factor = input.level * 0.001f;
+            minTmp *= factor;
+            maxTmp *= factor;
+        }
+
+        if (!input.extendLevels) {
+            if (originalMax == 0) {
+                // original max level is unlimited -> only limit by originalMin
+                minTmp = std::max(minTmp, originalMin * 1.0f);
+                if (input.maxLevel == 0) {
+                    // if maxLevel is 0, there will be no maximum level
+                    maxTmp = 0;
+                } else {
+                    maxTmp = std::max(maxTmp, originalMin * 1.0f);
+                }
+            } else {
+                // limit minTmp to original level range
+                minTmp = std::min(std::max(minTmp, originalMin * 1.0f), originalMax * 1.0f);
+                if (input.maxLevel == 0) {
+                    // if maxTmp == 0, max level is set as high as possible, which is originalMax
+                    maxTmp = originalMax;
+                } else {
+                    // limit maxTmp to original level range
+                    maxTmp = std::min(std::max(maxTmp, originalMin * 1.0f), originalMax * 1.0f);
+                }
+            }
+        }
+
+        LevelRange range;
+        range.min = static_cast<std::uint16_t>(minTmp);
+        range.max = static_cast<std::uint16_t>(maxTmp);
+
+        // limit to positive levels
+        if (range.min == 0) {
+            range.min = 1;
+        }
+        return range;
+    }
+
+    namespace {
+        LevelRangeInput GetBatchInput(const LevelRangeBatch& input, std::size_t i) {
+            LevelRangeInput result;
+            result.minLevel = input.minLevel[i];
+            result.maxLevel = input.maxLevel[i];
+            result.originalMin = input.originalMin[i];
+            result.originalMax = input.originalMax[i];
+            result.level = input.level[i];
+            result.includeLevelMult = input.includeLevelMult;
+            result.extendLevels = input.extendLevels;
+            return result;
+        }
+
+#if defined(EREZ_LEVEL_RANGES_AVX2)
+        constexpr std::size_t levelRangeLanes = 8;
+
+        __m256 LoadLevels(const std::uint16_t* values) {
+            auto packed = _mm_loadu_si128(reinterpret_cast<const __m128i*>(values));
+            return _mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(packed));
+        }
+
+        // truncates to int32 and keeps the low 16 bits, like the conversion of ComputeLevelRange
+        void StoreLevels(std::uint16_t* out, __m256 values) {
+            auto truncated = _mm256_cvttps_epi32(values);
+            truncated = _mm256_srai_epi32(_mm256_slli_epi32(truncated, 16), 16);
+            auto packed = _mm_packs_epi32(_mm256_castsi256_si128(truncated), _mm256_extracti128_si256(truncated, 1));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out), packed);
+        }
+
+        void ComputeLevelRangeLanes(const LevelRangeBatch& input, std::size_t i, std::uint16_t* outMin,
+                                    std::uint16_t* outMax) {
+            auto zero = _mm256_setzero_ps();
+            auto minLevel = LoadLevels(input.minLevel + i);
+            auto maxLevel = LoadLevels(input.maxLevel + i);
+            auto minTmp = minLevel;
+            auto maxTmp = maxLevel;
+            if (input.includeLevelMult) {
+                auto factor = _mm256_mul_ps(LoadLevels(input.level + i), _mm256_set1_ps(0.001f));
+                minTmp = _mm256_mul_ps(minTmp, factor);
+                maxTmp = _mm256_mul_ps(maxTmp, factor);
+            }
+            if (!input.extendLevels) {
+                auto originalMin = LoadLevels(input.originalMin + i);
+                auto originalMax = LoadLevels(input.originalMax + i);
+                auto unlimitedOriginal = _mm256_cmp_ps(originalMax, zero, _CMP_EQ_OQ);
+                auto unlimitedZone = _mm256_cmp_ps(maxLevel, zero, _CMP_EQ_OQ);
+
+                auto minRaised = _mm256_max_ps(minTmp, originalMin);
+                auto maxRaised = _mm256_max_ps(maxTmp, originalMin);
+                // original max level is unlimited -> only limit by originalMin
+                auto minUnlimited = minRaised;
+                auto maxUnlimited = _mm256_blendv_ps(maxRaised, zero, unlimitedZone);
+                // limit to original level range
+                auto minLimited = _mm256_min_ps(minRaised, originalMax);
+                auto maxLimited = _mm256_blendv_ps(_mm256_min_ps(maxRaised, originalMax), originalMax, unlimitedZone);
+
+                minTmp = _mm256_blendv_ps(minLimited, minUnlimited, unlimitedOriginal);
+                maxTmp = _mm256_blendv_ps(maxLimited, maxUnlimited, unlimitedOriginal);
+            }
+            StoreLevels(outMin + i, minTmp);
+            StoreLevels(outMax + i, maxTmp);
+
+            // limit to positive levels
+            for (std::size_t k = i; k < i + levelRangeLanes; ++k) {
+                if (outMin[k] == 0) {
+                    outMin[k] = 1;
+                }
+            }
+        }
+#elif defined(EREZ_LEVEL_RANGES_SSE2)
+        constexpr std::size_t levelRangeLanes = 4;
+
+        __m128 LoadLevels(const std::uint16_t* values) {
+            auto packed = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(values));
+            return _mm_cvtepi32_ps(_mm_unpacklo_epi16(packed, _mm_setzero_si128()));
+        }
+
+        __m128 Select(__m128 mask, __m128 ifTrue, __m128 ifFalse) {
+            return _mm_or_ps(_mm_and_ps(mask, ifTrue), _mm_andnot_ps(mask, ifFalse));
+        }
+
+        // truncates to int32 and keeps the low 16 bits, like the conversion of ComputeLevelRange
+        void StoreLevels(std::uint16_t* out, __m128 values) {
+            auto truncated = _mm_cvttps_epi32(values);
+            truncated = _mm_srai_epi32(_mm_slli_epi32(truncated, 16), 16);
+            _mm_storel_epi64(reinterpret_cast<__m128i*>(out), _mm_packs_epi32(truncated, truncated));
+        }
+
+        void ComputeLevelRangeLanes(const LevelRangeBatch& input, std::size_t i, std::uint16_t* outMin,
+                                    std::uint16_t* outMax) {
+            auto zero = _mm_setzero_ps();
+            auto minLevel = LoadLevels(input.minLevel + i);
+            auto maxLevel = LoadLevels(input.maxLevel + i);
+            auto minTmp = minLevel;
+            auto maxTmp = maxLevel;
+            if (input.includeLevelMult) {
+                auto factor = _mm_mul_ps(LoadLevels(input.level + i), _mm_set1_ps(0.001f));
+                minTmp = _mm_mul_ps(minTmp, factor);
+                maxTmp = _mm_mul_ps(maxTmp, factor);
+            }
+            if (!input.extendLevels) {
+                auto originalMin = LoadLevels(input.originalMin + i);
+                auto originalMax = LoadLevels(input.originalMax + i);
+                auto unlimitedOriginal = _mm_cmpeq_ps(originalMax, zero);
+                auto unlimitedZone = _mm_cmpeq_ps(maxLevel, zero);
+
+                auto minRaised = _mm_max_ps(minTmp, originalMin);
+                auto maxRaised = _mm_max_ps(maxTmp, originalMin);
+                // original max level is unlimited -> only limit by originalMin
+                auto minUnlimited = minRaised;
+                auto maxUnlimited = Select(unlimitedZone, zero, maxRaised);
+                // limit to original level range
+                auto minLimited = _mm_min_ps(minRaised, originalMax);
+                auto maxLimited = Select(unlimitedZone, originalMax, _mm_min_ps(maxRaised, originalMax));
+
+                minTmp = Select(unlimitedOriginal, minUnlimited, minLimited);
+                maxTmp = Select(unlimitedOriginal, maxUnlimited, maxLimited);
+            }
+            StoreLevels(outMin + i, minTmp);
+            StoreLevels(outMax + i, maxTmp);
+
+            // limit to positive levels
+            for (std::size_t k = i; k < i + levelRangeLanes; ++k) {
+                if (outMin[k] == 0) {
+                    outMin[k] = 1;
+                }
+            }
+        }
+#endif
+    }  // namespace
+
+    void ComputeLevelRanges(const LevelRangeBatch& input, std::uint16_t* outMin, std::uint16_t* outMax) {
+        std::size_t i = 0;
+#if defined(EREZ_LEVEL_RANGES_AVX2) || defined(EREZ_LEVEL_RANGES_SSE2)
+        for (; i + levelRangeLanes <= input.count; i += levelRangeLanes) {
+            ComputeLevelRangeLanes(input, i, outMin, outMax);
+        }
+#endif
+        for (; i < input.count; ++i) {
+            auto range = ComputeLevelRange(GetBatchInput(input, i));
+            outMin[i] = range.min;
+            outMax[i] = range.max;
+        }
+    }
+
+    std::array<std::int64_t, numAttributes> CalculateAttributes(const AttributeInput& input,
+                                                                const StatConstants& constants) {
+        std::array<std::int64_t, numAttributes> attributeValues = {};
+
+        auto level = input.level;
+        auto totalWeight = input.weights[0] + input.weights[1] + input.weights[2];
+
+        // distribute by descending weight, equal weights in attribute order
+        std::array<int, numAttributes> attributeIndices = {0, 1, 2};
+        std::sort(attributeIndices.begin(), attributeIndices.end(), [&](int first, int second) {
+            if (input.weights[first] != input.weights[second]) {
+                return input.weights[first] > input.weights[second];
+            }
+            return first < second;
+        });
+
+        auto totalAttributePoints = constants.attributesPerLevelUp * (level - 1);
+        for (auto index : attributeIndices) {
+            int weight = input.weights[index];
+            // attributes without weight get no points, the remaining weight is 0 once only they are left
+            auto add =
+                weight > 0 ? static_cast<std::int64_t>((1.0 * weight) / totalWeight * totalAttributePoints) : 0;
+            attributeValues[index] = add;
+            totalAttributePoints -= add;
+            totalWeight -= weight;
+        }
+
+        attributeValues[0] +=
+            input.offsets[0] + input.raceStartingValues[0] + (level - 1) * constants.healthLevelBonus;
+        attributeValues[1] += input.offsets[1] + input.raceStartingValues[1];
+        attributeValues[2] += input.offsets[2] + input.raceStartingValues[2];
+
+        attributeValues[0] = std::max(attributeValues[0], std::int64_t{0});
+        attributeValues[1] = std::max(attributeValues[1], std::int64_t{0});
+        attributeValues[2] = std::max(attributeValues[2], std::int64_t{0});
+
+        return attributeValues;
+    }
+
+    std::array<std::uint8_t, numSkills> CalculateSkills(const SkillInput& input, const StatConstants& constants) {
+        auto level = input.level;
+        auto skillsBase = constants.skillsBase;
+        auto skillsPerLevelUp = constants.skillsPerLevelUp;
+
+        std::uint32_t totalSkillWeights = 0;
+        for (std::size_t i = 0; i < numSkills; ++i) {
+            totalSkillWeights += input.weights[i];
+        }
+
+        std::array<std::uint8_t, numSkills> currentSkill;
+        currentSkill.fill(static_cast<std::uint8_t>(skillsBase));
+        for (const auto& boost : input.raceBoosts) {
+            if (boost.bonus != 0) {
+                int index = boost.skill - firstSkillActorValue;
+                if (index >= 0 && index < static_cast<int>(numSkills)) {
+                    currentSkill[index] = static_cast<std::uint8_t>(skillsBase + boost.bonus);
+                }
+            }
+        }
+
+        auto totalSkillPoints = skillsPerLevelUp * (level - 1);
+        auto remainingSkillPoints = totalSkillPoints;
+
+        // skills below 100 that take part in the excess distribution, and their fractional points lost to rounding
+        std::array<std::size_t, numSkills> sortedSkills = {};
+        std::array<double, numSkills> remainders = {};
+        std::size_t sortedCount = 0;
+
+        for (std::size_t i = 0; i < numSkills; ++i) {
+            if (input.weights[i] == 0) {
+                continue;
+            }
+            auto add = 1.0 * totalSkillPoints * input.weights[i] / totalSkillWeights;
+            auto addFloored = static_cast<int>(add);
+
+            auto addLimited = std::min(addFloored, 100 - currentSkill[i]);
+            currentSkill[i] += addLimited;
+            remainingSkillPoints -= addLimited;
+
+            if (currentSkill[i] < 100) {
+                sortedSkills[sortedCount++] = i;
+                remainders[i] = add - addFloored;
+            } else {
+                // the formula on the wiki does not go into detail how skills are distributed once at least one
+                // skill reaches 100 it seems that the skill points are redistributed to other skills, but in an
+                // unexpected way to account for this weird behavior the following adjustments are made they are not
+                // 100% accurate, but are closer to the real values than any reasonable algorithm I have found so
+                // far
+                auto over = std::lround((add - addLimited) /
+                                        (1.0 * skillsPerLevelUp * input.weights[i] / totalSkillWeights));
+                over = std::min(3l, over);
+                remainingSkillPoints -= 4 * over - 2;
+            }
+        }
+
+        if (remainingSkillPoints <= 0) {
+            return currentSkill;
+        }
+
+        // excess points go to the largest remainders first, then to the lowest skills, then to the highest index
+        // The original list based implementation sorted again before every round, which reversed skills with equal
+        // remainder and skill level each time. The final round below reproduces that order for odd round counts.
+        auto sortedEnd = sortedSkills.begin() + sortedCount;
+        std::sort(sortedSkills.begin(), sortedEnd, [&](std::size_t first, std::size_t second) {
+            if (remainders[first] != remainders[second]) {
+                return remainders[first] > remainders[second];
+            }
+            if (currentSkill[first] != currentSkill[second]) {
+                return currentSkill[first] < currentSkill[second];
+            }
+            return first > second;
+        });
+
+        // Each round raises every skill below 100 by one point in this order. Rounds keep the relative order of the
+        // skills, so the order is computed once and complete rounds are applied in bulk until a skill reaches 100.
+        int completedRounds = 0;
+        while (remainingSkillPoints > 0 && sortedCount > 0) {
+            int headroom = 100;
+            for (std::size_t k = 0; k < sortedCount; ++k) {
+                headroom = std::min(headroom, 100 - currentSkill[sortedSkills[k]]);
+            }
+            auto rounds = std::min(headroom, remainingSkillPoints / static_cast<int>(sortedCount));
+            if (rounds == 0) {
+                // the last round runs out of points before reaching every skill
+                if (completedRounds % 2 == 1) {
+                    for (std::size_t k = 0; k < sortedCount;) {
+                        auto end = k + 1;
+                        while (end < sortedCount && remainders[sortedSkills[end]] == remainders[sortedSkills[k]] &&
+                               currentSkill[sortedSkills[end]] == currentSkill[sortedSkills[k]]) {
+                            end++;
+                        }
+                        std::reverse(sortedSkills.begin() + k, sortedSkills.begin() + end);
+                        k = end;
+                    }
+                }
+                for (int k = 0; k < remainingSkillPoints; ++k) {
+                    currentSkill[sortedSkills[k]]++;
+                }
+                break;
+            }
+            std::size_t keep = 0;
+            for (std::size_t k = 0; k < sortedCount; ++k) {
+                auto i = sortedSkills[k];
+                currentSkill[i] += rounds;
+                if (currentSkill[i] < 100) {
+                    sortedSkills[keep++] = i;
+                }
+            }
+            remainingSkillPoints -= rounds * static_cast<int>(sortedCount);
+            completedRounds += rounds;
+            sortedCount = keep;
+        }
+        return currentSkill;
+    }
+}  // namespace EREZ
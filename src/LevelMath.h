@@ -0,0 +1,88 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+// Leveling math without CommonLibSSE dependencies, so it can be built and profiled on any host. Nothing allocates.
+namespace EREZ {
+    inline constexpr std::size_t numAttributes = 3;
+    inline constexpr std::size_t numSkills = 18;
+    inline constexpr std::size_t numSkillBoosts = 7;
+
+    // The first skill actor value (one-handed)
+    inline constexpr std::int32_t firstSkillActorValue = 6;
+
+    // level is the raw level field, i.e. the PC level mult times 1000. A max level of 0 means there is no maximum
+    // level. The original range must already be valid (originalMin <= originalMax unless originalMax is 0)
+    struct LevelRangeInput {
+        std::uint16_t minLevel = 0;
+        std::uint16_t maxLevel = 0;
+        std::uint16_t originalMin = 0;
+        std::uint16_t originalMax = 0;
+        std::uint16_t level = 0;
+        bool includeLevelMult = false;
+        bool extendLevels = false;
+    };
+
+    // A calculated level range. A max of 0 means there is no maximum level.
+    struct LevelRange {
+        std::uint16_t min = 1;
+        std::uint16_t max = 0;
+    };
+
+    // Inputs of the level range calculation of many npcs, as one array per field. All arrays have count elements.
+    struct LevelRangeBatch {
+        const std::uint16_t* minLevel = nullptr;
+        const std::uint16_t* maxLevel = nullptr;
+        const std::uint16_t* originalMin = nullptr;
+        const std::uint16_t* originalMax = nullptr;
+        const std::uint16_t* level = nullptr;
+        std::size_t count = 0;
+        bool includeLevelMult = false;
+        bool extendLevels = false;
+    };
+
+    // Game settings that control attribute and skill growth.
+    struct StatConstants {
+        int healthLevelBonus = 0;
+        int attributesPerLevelUp = 0;
+        int skillsPerLevelUp = 0;
+        int skillsBase = 0;
+    };
+
+    // Inputs of the attribute calculation of an npc, in the order health, magicka, stamina.
+    struct AttributeInput {
+        std::uint16_t level = 1;
+        std::array<std::uint8_t, numAttributes> weights = {};
+        std::array<std::int32_t, numAttributes> offsets = {};
+        std::array<float, numAttributes> raceStartingValues = {};
+    };
+
+    // A racial skill bonus. The skill is the actor value of the skill.
+    struct SkillBoost {
+        std::int32_t skill = 0;
+        std::int32_t bonus = 0;
+    };
+
+    // Inputs of the skill calculation of an npc.
+    struct SkillInput {
+        std::uint16_t level = 1;
+        std::array<std::uint8_t, numSkills> weights = {};
+        std::array<SkillBoost, numSkillBoosts> raceBoosts = {};
+    };
+
+    // Level range of an npc in an encounter zone, limited to the original range unless extendLevels is set
+    LevelRange ComputeLevelRange(const LevelRangeInput& input);
+
+    // Same results as ComputeLevelRange, using AVX2 or SSE2 where available
+    void ComputeLevelRanges(const LevelRangeBatch& input, std::uint16_t* outMin, std::uint16_t* outMax);
+
+    // Emulates Skyrim's calculation of base health, magicka and stamina
+    std::array<std::int64_t, numAttributes> CalculateAttributes(const AttributeInput& input,
+                                                                const StatConstants& constants);
+
+    // Emulates Skyrim's skill calculation: points are distributed by class weights, the rest is handed out in order of
+    // the fractions lost to rounding. Racial boosts with an invalid skill are ignored
+    std::array<std::uint8_t, numSkills> CalculateSkills(const SkillInput& input, const StatConstants& constants);
+}  // namespace EREZ
@@ -68,6 +68,7 @@ namespace {
                     case MessagingInterface::kPostLoad:  // Called after all plugins have finished running
                                                          // SKSEPlugin_Load. It is now safe to do multithreaded
                                                          // operations, or operations against other plugins.
+                        EREZ::OnPluginsLoaded();
                         break;
                     case MessagingInterface::kPostPostLoad:  // Called after all kPostLoad message handlers have run.
                         break;
@@ -96,6 +97,7 @@ namespace {
                         break;
                     case MessagingInterface::kSaveGame:  // The player has saved a game.
                                                          // Data will be the save name.
+                        EREZ::OnSave();
                         break;
                     case MessagingInterface::kDeleteGame:  // The player deleted a saved game from within the load menu.
                         break;
@@ -104,6 +104,7 @@
 #include <Psapi.h>
 #undef cdecl // Workaround for Clang 14 CMake configure error.
 
+#include <spdlog/async.h>
 #include <spdlog/sinks/basic_file_sink.h>
 #include <spdlog/sinks/msvc_sink.h>
 
@@ -115,6 +116,19 @@ using namespace REL::literals;
 
 namespace logger = SKSE::log;
 
+// Trace logging for hot paths. The arguments are only evaluated if trace logging is enabled at runtime, and defining
+// EREZ_STRIP_TRACE removes the trace sites completely.
+#ifdef EREZ_STRIP_TRACE
+#define EREZ_TRACE(...) static_cast<void>(0)
+#else
+#define EREZ_TRACE(...)                                                           \
+    do {                                                                          \
+        if (spdlog::default_logger_raw()->should_log(spdlog::level::trace)) {     \
+            logger::trace(__VA_ARGS__);                                           \
+        }                                                                         \
+    } while (false)
+#endif
+
 namespace util {
     using SKSE::stl::report_and_fail;
 }
@@ -8,7 +8,12 @@
 #include <unordered_set>
 #include <utility>
 
+#include "EREZ/API.h"
+#include "FlatMap.h"
+#include "LevelMath.h"
+#include "RelevelQueue.h"
 #include "SimpleIni.h"
+#include "TraceFormat.h"
 
 RE::BGSEncounterZone* GetEncounterZone(RE::TESObjectREFR* This) {
     using func_t = decltype(&GetEncounterZone);
@@ -43,11 +48,35 @@ namespace EREZ {
         }
     };
 
+    // Settings are immutable snapshots. A reload publishes a new snapshot atomically. The replaced snapshot is kept
+    // until the next reload, because event sinks on other threads may still be reading it
     class Settings {
     public:
-        [[nodiscard]] static Settings* GetSingleton() {
-            static Settings singleton;
-            return std::addressof(singleton);
+        static constexpr auto path = L"Data/SKSE/Plugins/EnemiesRespectEncounterZones.ini";
+
+        [[nodiscard]] static const Settings* GetSingleton() {
+            [[maybe_unused]] static const auto initial = Reload();
+            return currentSnapshot.load(std::memory_order_acquire);
+        }
+
+        // Loads the INI file into a new snapshot and publishes it. Reloads run on the main thread, which does not
+        // keep a snapshot across tasks, and the settings watcher reloads at most once per second
+        static const Settings* Reload() {
+            std::lock_guard<std::mutex> guard(reloadLock);
+            std::unique_ptr<Settings> settings(new Settings());
+            settings->Load();
+            auto result = settings.get();
+            currentSnapshot.store(result, std::memory_order_release);
+            previousSnapshot = std::exchange(ownedSnapshot, std::move(settings));
+            return result;
+        }
+
+        // Returns whether the plugin filter of both snapshots is the same.
+        [[nodiscard]] bool SamePluginFilter(const Settings& other) const {
+            return pluginFilterInvert == other.pluginFilterInvert &&
+                   pluginFilterMasterList == other.pluginFilterMasterList &&
+                   pluginFilterAnyList == other.pluginFilterAnyList &&
+                   pluginFilterWinningList == other.pluginFilterWinningList;
         }
 
         int logLevel = 2;
@@ -71,14 +100,24 @@ namespace EREZ {
 
         bool manualUninstall = false;
 
+        bool startupCache = true;
+        bool watchSettings = true;
+        int perfLogInterval = 0;
+        bool captureTrace = false;
+        bool cellBatch = true;
+        int statBudgetMicroseconds = 2000;
+
+        bool asyncLogging = false;
+        int asyncLogQueueSize = 8192;
+        int asyncLogOverflow = 0;
+        int logFlushInterval = 1;
+
         std::unordered_set<std::string> pluginFilterMasterList;
         std::unordered_set<std::string> pluginFilterAnyList;
         std::unordered_set<std::string> pluginFilterWinningList;
         bool usePluginFilter = false;
 
         void Load() {
-            constexpr auto path = L"Data/SKSE/Plugins/EnemiesRespectEncounterZones.ini";
-
             CSimpleIniA ini;
             ini.SetUnicode();
 
@@ -149,7 +188,50 @@ namespace EREZ {
                    ";To remove level changes from a save, set this to true. Load the save and make a new save. "
                    "Afterwards you can uninstall the mod. Already spawned npcs may keep their levels.");
 
-            ini.SaveFile(path);
+            getIni(ini, startupCache, "bStartupCache",
+                   ";Stores the original levels of all NPCs in EnemiesRespectEncounterZones.cache, so they do not have "
+                   "to be read again on the next start with the same load order and plugin filter.");
+
+            getIni(ini, watchSettings, "bWatchSettings",
+                   ";Reloads this file when it is changed while the game is running. Changes to this setting, "
+                   "bStartupCache and the logging settings other than iLogLevel only take effect after a restart.");
+
+            getIni(ini, perfLogInterval, "iPerfLogInterval",
+                   ";Logs performance counters every this many seconds, if iLogLevel is 1 or lower. 0 only logs them "
+                   "when a game is saved or loaded.");
+
+            getIni(ini, statBudgetMicroseconds, "iStatBudgetMicroseconds",
+                   ";Maximum time in microseconds spent on stat recalculation per frame. Remaining actors are "
+                   "recalculated in the next frames, actors in combat and close to the player first. 0 recalculates "
+                   "all actors at once.");
+
+            getIni(ini, cellBatch, "bCellBatch",
+                   ";When a cell is attached, all actors in it are processed together in one pass, instead of one by "
+                   "one as their events arrive.");
+
+            getIni(ini, captureTrace, "bCaptureTrace",
+                   ";Writes the inputs of the level and stat calculations to EnemiesRespectEncounterZones.trace, so "
+                   "they can be replayed outside of the game. Only read at startup.");
+
+            getIni(ini, asyncLogging, "bAsyncLogging",
+                   ";Writes the log file from a background thread instead of the game thread that logs a message. "
+                   "Recommended when iLogLevel is 0 or 1. Only read at startup.");
+            getIni(ini, asyncLogQueueSize, "iAsyncLogQueueSize",
+                   ";Number of messages that can wait to be written if bAsyncLogging is enabled.");
+            getIni(ini, asyncLogOverflow, "iAsyncLogOverflow",
+                   ";What happens if bAsyncLogging is enabled and the message queue is full.\n"
+                   ";0: wait until there is space in the queue\n"
+                   ";1: drop the oldest queued message\n"
+                   ";2: drop the new message\n"
+                   ";Dropped messages are counted and reported in the log.");
+            getIni(ini, logFlushInterval, "iLogFlushInterval",
+                   ";If bAsyncLogging is enabled, the log file is flushed every this many seconds. Warnings and errors "
+                   "are always flushed immediately.");
+
+            // only write the file if settings were added, so user formatting is kept otherwise
+            if (missingKeys) {
+                ini.SaveFile(path);
+            }
 
             auto log = spdlog::default_logger().get();
             auto newLogLevel = spdlog::level::level_enum::info;
@@ -181,7 +263,7 @@ namespace EREZ {
             log->flush_on(spdlog::level::level_enum::info);
             logger::info("Setting log level to \"{}\".", newLogLevelName);
             log->set_level(newLogLevel);
-            log->flush_on(newLogLevel);
+            log->flush_on(IsAsyncLogger(log) ? std::max(newLogLevel, spdlog::level::level_enum::warn) : newLogLevel);
 
             pluginFilterMasterList = Helper::splitString(pluginFilterMaster, ',');
             pluginFilterAnyList = Helper::splitString(pluginFilterAny, ',');
@@ -200,289 +282,1820 @@ namespace EREZ {
             }
         }
 
+        // Replaces the default logger with an asynchronous logger with the same sinks, written by a background thread.
+        // Called once at kPostLoad, when threads may be started. spdlog queues messages in a mutex guarded blocking
+        // queue, so a logging thread still takes a lock per message, but the pattern formatting, file writes and
+        // flushes move to the background thread.
+        static void StartAsyncLogging() {
+            auto settings = GetSingleton();
+            auto current = spdlog::default_logger();
+            if (!settings->asyncLogging || IsAsyncLogger(current.get())) {
+                return;
+            }
+            auto policy = spdlog::async_overflow_policy::block;
+            if (settings->asyncLogOverflow == 1) {
+                policy = spdlog::async_overflow_policy::overrun_oldest;
+            } else if (settings->asyncLogOverflow == 2) {
+                policy = spdlog::async_overflow_policy::discard_new;
+            }
+            spdlog::init_thread_pool(static_cast<std::size_t>(std::max(settings->asyncLogQueueSize, 1)), 1);
+            auto log = std::make_shared<spdlog::async_logger>(current->name(), current->sinks().begin(),
+                                                              current->sinks().end(), spdlog::thread_pool(), policy);
+            log->set_level(current->level());
+            log->flush_on(std::max(current->level(), spdlog::level::level_enum::warn));
+            spdlog::set_default_logger(log);
+            if (settings->logFlushInterval > 0) {
+                spdlog::flush_every(std::chrono::seconds(settings->logFlushInterval));
+            }
+            logger::info("Using asynchronous logging with a queue of {} messages.", settings->asyncLogQueueSize);
+        }
+
+        // Logs how many messages were dropped because the asynchronous log queue was full.
+        static void LogDroppedMessages() {
+            auto threadPool = spdlog::thread_pool();
+            if (!threadPool) {
+                return;
+            }
+            auto dropped = threadPool->overrun_counter() + threadPool->discard_counter();
+            if (dropped > 0) {
+                logger::warn("Dropped {} log messages, because the log queue was full.", dropped);
+                threadPool->reset_overrun_counter();
+                threadPool->reset_discard_counter();
+            }
+        }
+
     private:
-        Settings() { Load(); }
+        static inline std::atomic<const Settings*> currentSnapshot = nullptr;
+        static inline std::mutex reloadLock;
+        static inline std::unique_ptr<Settings> ownedSnapshot;
+        static inline std::unique_ptr<Settings> previousSnapshot;
+
+        bool missingKeys = false;
+
+        Settings() = default;
+
+        static bool IsAsyncLogger(spdlog::logger* log) { return dynamic_cast<spdlog::async_logger*>(log) != nullptr; }
 
         static constexpr auto iniCategory = "General";
 
-        static void getIni(CSimpleIniA& ini, bool& defaultValue, const char* settingName, const char* a_comment) {
+        void getIni(CSimpleIniA& ini, bool& defaultValue, const char* settingName, const char* a_comment) {
+            CheckMissing(ini, settingName);
             defaultValue = ini.GetBoolValue(iniCategory, settingName, defaultValue);
             ini.SetBoolValue(iniCategory, settingName, defaultValue, a_comment);
         }
 
-        static void getIni(CSimpleIniA& ini, std::int32_t& defaultValue, const char* settingName,
-                           const char* a_comment) {
+        void getIni(CSimpleIniA& ini, std::int32_t& defaultValue, const char* settingName, const char* a_comment) {
+            CheckMissing(ini, settingName);
             defaultValue = std::stoi(ini.GetValue(iniCategory, settingName, std::to_string(defaultValue).c_str()));
             ini.SetValue(iniCategory, settingName, std::to_string(defaultValue).c_str(), a_comment);
         }
 
-        static void getIni(CSimpleIniA& ini, float& defaultValue, const char* settingName, const char* a_comment) {
+        void getIni(CSimpleIniA& ini, float& defaultValue, const char* settingName, const char* a_comment) {
+            CheckMissing(ini, settingName);
             defaultValue = std::stof(ini.GetValue(iniCategory, settingName, std::to_string(defaultValue).c_str()));
             ini.SetValue(iniCategory, settingName, std::to_string(defaultValue).c_str(), a_comment);
         }
 
-        static void getIni(CSimpleIniA& ini, std::string& defaultValue, const char* settingName,
-                           const char* a_comment) {
+        void getIni(CSimpleIniA& ini, std::string& defaultValue, const char* settingName, const char* a_comment) {
+            CheckMissing(ini, settingName);
             defaultValue = ini.GetValue(iniCategory, settingName, defaultValue.c_str());
             ini.SetValue(iniCategory, settingName, defaultValue.c_str(), a_comment);
         }
+
+        void CheckMissing(CSimpleIniA& ini, const char* settingName) {
+            if (!ini.GetValue(iniCategory, settingName, nullptr)) {
+                missingKeys = true;
+            }
+        }
+    };
+
+    // Polls the modification time of the INI file and reloads the settings when it changes.
+    class SettingsWatcher {
+    public:
+        static void Start(std::function<void()> onChanged) {
+            std::thread([onChanged = std::move(onChanged)]() {
+                auto lastWriteTime = GetWriteTime();
+                while (true) {
+                    std::this_thread::sleep_for(std::chrono::seconds(1));
+                    auto writeTime = GetWriteTime();
+                    if (writeTime != lastWriteTime) {
+                        lastWriteTime = writeTime;
+                        onChanged();
+                    }
+                }
+            }).detach();
+        }
+
+    private:
+        static std::filesystem::file_time_type GetWriteTime() {
+            std::error_code ec;
+            auto time = std::filesystem::last_write_time(Settings::path, ec);
+            return ec ? std::filesystem::file_time_type{} : time;
+        }
     };
 
+    inline const auto SerializationID = _byteswap_ulong('EREZ');
     inline const auto Record_originalActorBaseLevels = _byteswap_ulong('TACT');
+    inline constexpr std::uint32_t Record_originalActorBaseLevelsVersion = 1;
+    inline const auto Record_modifiedNpcs = _byteswap_ulong('TNPC');
+    inline constexpr std::uint32_t Record_modifiedNpcsVersion = 1;
+
+    // The events that can cause an actor to be processed. Several of them usually fire for the same actor while a cell
+    // is loading, so they are collected as a bit mask per actor.
+    enum class EventSource : std::uint8_t {
+        kObjectLoaded = 1 << 0,
+        kInitScript = 1 << 1,
+        kCellAttach = 1 << 2,
+        kMoveAttach = 1 << 3,
+    };
 
-    class UnlevelManager {
-    public:
-        int healthLevelBonus = 0;
-        int attributesPerLevelUp = 0;
-        int skillsPerLevelUp = 0;
-        int skillsBase = 0;
+    inline constexpr std::array<const char*, 4> eventSourceNames = {
+        "TESObjectLoadedEvent", "TESInitScriptEvent", "TESCellAttachDetachEvent", "TESMoveAttachDetachEvent"};
 
-        static UnlevelManager* GetSingleton() {
-            static UnlevelManager singleton;
-            return &singleton;
+    inline std::string FormatLevelRange(std::uint16_t minLevel, std::uint16_t maxLevel) {
+        if (maxLevel == 0) {
+            return std::format("{}+", minLevel);
         }
+        return std::format("{}-{}", minLevel, maxLevel);
+    }
 
-        struct actorbaseData {
-            uint16_t originalMin;
-            uint16_t originalMax;
-        };
+    inline std::string GetEventSourceNames(std::uint8_t eventSources) {
+        std::string result;
+        for (std::size_t i = 0; i < eventSourceNames.size(); ++i) {
+            if (eventSources & (1 << i)) {
+                if (!result.empty()) {
+                    result += ", ";
+                }
+                result += eventSourceNames[i];
+            }
+        }
+        return result;
+    }
 
-        struct dynamicData {
-            uint16_t originalMin;
-            uint16_t originalMax;
-            uint16_t modifiedMin;
-            uint16_t modifiedMax;
-            void* pointer;
-        };
+    // Set of plugins, stored by the compile indices of the loaded plugins.
+    class PluginFileMask {
+    public:
+        void Set(const TESFile* file) {
+            if (file->compileIndex == 0xFE) {
+                light.set(file->smallFileCompileIndex);
+            } else if (file->compileIndex < full.size()) {
+                full.set(file->compileIndex);
+            }
+        }
 
-        void OnPreLoad() {
-            // When loading a save, reset all normal npc records
-            // This happens before dynamic npc records are created, which are based on the normal ones and will now also
-            // use the reset values
-            ResetToOriginal();
-            // Reset all dynamic data, as dynamic FormIDs are recycled, so they may now refer to different objects
-            dynamicActorBaseLevels.clear();
+        [[nodiscard]] bool Test(const TESFile* file) const {
+            if (file->compileIndex == 0xFE) {
+                return light.test(file->smallFileCompileIndex);
+            }
+            return file->compileIndex < full.size() && full.test(file->compileIndex);
         }
 
-        void OnPostLoad() {
-            // after the save is loaded, levels are also loaded and need to be reset when uninstalling
-            // this only affects normal npcs, so dynamic npcs will keep their level until they respawn
-            auto settings = Settings::GetSingleton();
-            if (settings->manualUninstall) {
-                ResetToOriginal();
-                logger::info("Npc levels have been reset. Mod can be uninstalled now.");
+    private:
+        std::bitset<0xFE> full;
+        std::bitset<0x1000> light;
+    };
+
+    // 64-bit FNV-1a hash.
+    class Fnv1a {
+    public:
+        void Add(const void* data, std::size_t size) {
+            auto bytes = static_cast<const std::uint8_t*>(data);
+            for (std::size_t i = 0; i < size; ++i) {
+                hash = (hash ^ bytes[i]) * 0x100000001B3ull;
             }
         }
 
-        void OnDataInit() {
-            ReadOriginalData();
-            skillsPerLevelUp = GameSettingCollection::GetSingleton()->GetSetting("iAVDskillsLevelUp")->GetSInt();
-            logger::trace("iAVDskillsLevelUp = {}", skillsPerLevelUp);
-            skillsBase = GameSettingCollection::GetSingleton()->GetSetting("iAVDSkillStart")->GetSInt();
-            logger::trace("iAVDSkillStart = {}", skillsBase);
-            attributesPerLevelUp = GameSettingCollection::GetSingleton()->GetSetting("iAVDhmsLevelUp")->GetSInt();
-            logger::trace("iAVDhmsLevelUp = {}", attributesPerLevelUp);
-            healthLevelBonus = GameSettingCollection::GetSingleton()->GetSetting("fNPCHealthLevelBonus")->GetFloat();
-            logger::trace("fNPCHealthLevelBonus = {}", healthLevelBonus);
+        template <typename T>
+        void Add(const T& value) {
+            static_assert(std::is_trivially_copyable_v<T>);
+            Add(std::addressof(value), sizeof(T));
+        }
+
+        void Add(std::string_view str) {
+            Add(str.size());
+            Add(str.data(), str.size());
         }
 
+        [[nodiscard]] std::uint64_t Get() const { return hash; }
+
     private:
-        mutable std::mutex _lock;
-        std::unordered_map<FormID, actorbaseData> originalActorBaseLevels;
-        std::unordered_map<FormID, dynamicData> dynamicActorBaseLevels;
+        std::uint64_t hash = 0xCBF29CE484222325ull;
+    };
 
-        void SetActorBaseData(TESNPC* base, uint16_t originalMin, uint16_t originalMax, uint16_t min, uint16_t max) {
-            auto baseFormID = base->GetFormID();
-            if (baseFormID >= 0xff000000) {
-                dynamicActorBaseLevels.insert_or_assign(baseFormID,
-                                                        dynamicData{originalMin, originalMax, min, max, base});
+    // A read-only memory mapping of a file.
+    class MappedFile {
+    public:
+        explicit MappedFile(const std::filesystem::path& path) {
+            file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                               FILE_ATTRIBUTE_NORMAL, nullptr);
+            if (file == INVALID_HANDLE_VALUE) {
+                return;
+            }
+            LARGE_INTEGER fileSize;
+            if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0) {
+                return;
+            }
+            mapping = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+            if (!mapping) {
+                return;
+            }
+            view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+            if (view) {
+                size = static_cast<std::size_t>(fileSize.QuadPart);
             }
-            base->actorData.calcLevelMin = min;
-            base->actorData.calcLevelMax = max;
         }
 
-        actorbaseData GetOriginalActorBaseData(TESNPC* base) {
-            auto baseFormID = base->GetFormID();
-            uint16_t originalMin = 0;
-            uint16_t originalMax = 0;
+        MappedFile(const MappedFile&) = delete;
+        MappedFile& operator=(const MappedFile&) = delete;
 
-            const void* address = static_cast<const void*>(base);
-            std::stringstream ss;
-            ss << address;
-            auto str = ss.str();
-            if (baseFormID >= 0xff000000) {
-                bool dynamicDataIsValid = false;
+        ~MappedFile() {
+            if (view) {
+                UnmapViewOfFile(view);
+            }
+            if (mapping) {
+                CloseHandle(mapping);
+            }
+            if (file != INVALID_HANDLE_VALUE) {
+                CloseHandle(file);
+            }
+        }
 
-                if (dynamicActorBaseLevels.find(baseFormID) != dynamicActorBaseLevels.end()) {
-                    auto& tmp = dynamicActorBaseLevels.at(baseFormID);
-                    if (tmp.modifiedMin == base->actorData.calcLevelMin &&
-                        tmp.modifiedMax == base->actorData.calcLevelMax && tmp.pointer == base) {
-                        dynamicDataIsValid = true;
-                    } else {
-                        dynamicActorBaseLevels.erase(baseFormID);
+        [[nodiscard]] std::span<const std::byte> Data() const {
+            return {static_cast<const std::byte*>(view), size};
+        }
+
+    private:
+        HANDLE file = INVALID_HANDLE_VALUE;
+        HANDLE mapping = nullptr;
+        void* view = nullptr;
+        std::size_t size = 0;
+    };
+
+    // Flags and original level ranges of all npc records, read once at kDataLoaded into arrays sorted by FormID
+    // Plugin filter names are resolved to compile indices, dynamic npc records are evaluated on demand
+    // The arrays are cached in a file keyed by the load order and the plugin filter
+    class NpcTable {
+    public:
+        enum Flag : std::uint8_t {
+            kPCLevelMult = 1 << 0,
+            kUnique = 1 << 1,
+            kSummonable = 1 << 2,
+            kPluginAllowed = 1 << 3,
+        };
+
+        [[nodiscard]] static constexpr bool IsEligible(std::uint8_t flags) {
+            return (flags & (kPCLevelMult | kPluginAllowed)) == (kPCLevelMult | kPluginAllowed);
+        }
+
+        static constexpr std::uint32_t npos = std::numeric_limits<std::uint32_t>::max();
+
+        void Build() {
+            auto start = std::chrono::steady_clock::now();
+            // Before any save is loaded all npc records are processed to store the original level values
+            // the original values are required for the lower and upper bounds
+            ResolvePluginFilter();
+
+            auto useCache = Settings::GetSingleton()->startupCache;
+            auto cacheKey = useCache ? ComputeCacheKey() : 0;
+            if (useCache && ReadCache(cacheKey)) {
+                auto duration = std::chrono::duration_cast<std::chrono::microseconds>(
+                    std::chrono::steady_clock::now() - start);
+                logger::debug("Read npc data for {} npcs from the cache in {} us.", formIDs.size(), duration.count());
+                BuildIndex();
+                return;
+            }
+
+            struct Entry {
+                FormID formID;
+                std::uint8_t flags;
+                std::uint16_t originalMin;
+                std::uint16_t originalMax;
+            };
+            std::vector<Entry> entries;
+            const auto dataHandler = RE::TESDataHandler::GetSingleton();
+            if (dataHandler) {
+                const auto& npcs = dataHandler->GetFormArray<RE::TESNPC>();
+                entries.reserve(npcs.size());
+                for (const auto& npc : npcs) {
+                    if (npc) {
+                        entries.push_back(Entry{npc->GetFormID(), ComputeFlags(npc), npc->actorData.calcLevelMin,
+                                                npc->actorData.calcLevelMax});
                     }
                 }
-                if (!dynamicDataIsValid) {
-                    originalMin = base->actorData.calcLevelMin;
-                    originalMax = base->actorData.calcLevelMax;
-                } else {
-                    auto& tmp = dynamicActorBaseLevels.at(baseFormID);
-                    originalMin = tmp.originalMin;
-                    originalMax = tmp.originalMax;
+            }
+            std::sort(entries.begin(), entries.end(),
+                      [](const Entry& first, const Entry& second) { return first.formID < second.formID; });
+
+            formIDs.resize(entries.size());
+            flags.resize(entries.size());
+            originalMin.resize(entries.size());
+            originalMax.resize(entries.size());
+            std::size_t eligible = 0;
+            for (std::size_t i = 0; i < entries.size(); ++i) {
+                formIDs[i] = entries[i].formID;
+                flags[i] = entries[i].flags;
+                originalMin[i] = entries[i].originalMin;
+                originalMax[i] = entries[i].originalMax;
+                if (IsEligible(flags[i])) {
+                    eligible++;
                 }
-            } else {
-                if (originalActorBaseLevels.find(baseFormID) == originalActorBaseLevels.end()) {
-                    originalMin = base->actorData.calcLevelMin;
-                    originalMax = base->actorData.calcLevelMax;
-                    originalActorBaseLevels.insert_or_assign(baseFormID, actorbaseData{originalMin, originalMax});
+            }
+            BuildIndex();
+            if (useCache) {
+                WriteCache(cacheKey);
+            }
+            auto duration =
+                std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+            logger::debug("Initialized npc data for {} npcs in {} us, {} of them are eligible for releveling.",
+                          formIDs.size(), duration.count(), eligible);
+        }
+
+        [[nodiscard]] std::uint32_t Find(FormID formID) const {
+            if (formID >= 0xff000000) {
+                return npos;
+            }
+            auto index = indexOf.Find(formID);
+            return index ? *index : npos;
+        }
+
+        [[nodiscard]] std::uint8_t GetFlags(TESNPC* base) const {
+            auto index = Find(base->GetFormID());
+            if (index != npos) {
+                return flags[index];
+            }
+            return ComputeFlags(base);
+        }
+
+        // Resolves the plugin filter again and updates the kPluginAllowed flag of all npc records.
+        void RefilterPlugins() {
+            ResolvePluginFilter();
+            for (std::size_t i = 0; i < formIDs.size(); ++i) {
+                auto npc = TESForm::LookupByID<TESNPC>(formIDs[i]);
+                if (!npc) {
+                    continue;
+                }
+                if (PluginFilter(npc)) {
+                    flags[i] |= kPluginAllowed;
                 } else {
-                    auto& tmp = originalActorBaseLevels.at(baseFormID);
-                    originalMin = tmp.originalMin;
-                    originalMax = tmp.originalMax;
+                    flags[i] &= ~kPluginAllowed;
                 }
             }
-            return actorbaseData{originalMin, originalMax};
         }
 
-        void ResetToOriginal() {
-            logger::debug("Resetting npc data...");
-            int count = 0;
-            int total = 0;
+        [[nodiscard]] std::size_t Size() const { return formIDs.size(); }
+        [[nodiscard]] FormID GetFormID(std::uint32_t index) const { return formIDs[index]; }
+        [[nodiscard]] std::uint8_t GetFlags(std::uint32_t index) const { return flags[index]; }
+        [[nodiscard]] std::uint16_t GetOriginalMin(std::uint32_t index) const { return originalMin[index]; }
+        [[nodiscard]] std::uint16_t GetOriginalMax(std::uint32_t index) const { return originalMax[index]; }
+
+    private:
+        std::vector<FormID> formIDs;
+        std::vector<std::uint8_t> flags;
+        std::vector<std::uint16_t> originalMin;
+        std::vector<std::uint16_t> originalMax;
+        // array index by FormID, a binary search over the sorted FormIDs misses the cache on every step
+        FlatMap<FormID, std::uint32_t> indexOf;
+
+        void BuildIndex() {
+            indexOf.Clear();
+            indexOf.Reserve(formIDs.size());
+            for (std::size_t i = 0; i < formIDs.size(); ++i) {
+                indexOf.InsertOrAssign(formIDs[i], static_cast<std::uint32_t>(i));
+            }
+        }
+
+        bool usePluginFilter = false;
+        bool pluginFilterInvert = false;
+        PluginFileMask pluginFilterMaster;
+        PluginFileMask pluginFilterAny;
+        PluginFileMask pluginFilterWinning;
+        bool usePluginFilterAny = false;
+
+        static constexpr auto cachePath = L"Data/SKSE/Plugins/EnemiesRespectEncounterZones.cache";
+        static constexpr std::uint32_t cacheMagic = 'EREZ';
+        static constexpr std::uint32_t cacheVersion = 1;
+
+        // The header is followed by the FormIDs, original min levels, original max levels and flags, each as an array
+        // of count elements.
+        struct CacheHeader {
+            std::uint32_t magic;
+            std::uint32_t version;
+            std::uint64_t key;
+            std::uint64_t payloadHash;
+            std::uint32_t count;
+            std::uint32_t reserved;
+        };
+        static_assert(sizeof(CacheHeader) == 32);
+
+        static constexpr std::size_t cacheEntrySize =
+            sizeof(FormID) + 2 * sizeof(std::uint16_t) + sizeof(std::uint8_t);
+
+        // Size and last write time from the directory entry the game keeps for each loaded plugin, so the key does not
+        // access the plugin files. CommonLibSSE versions name the Win32 fields differently.
+        template <typename FindData>
+        static void AddFileStamp(Fnv1a& hash, const FindData& data) {
+            if constexpr (requires { data.nFileSizeLow; }) {
+                hash.Add(data.nFileSizeHigh);
+                hash.Add(data.nFileSizeLow);
+                hash.Add(data.ftLastWriteTime.dwHighDateTime);
+                hash.Add(data.ftLastWriteTime.dwLowDateTime);
+            } else {
+                hash.Add(data.fileSizeHigh);
+                hash.Add(data.fileSizeLow);
+                hash.Add(data.lastWriteTime.highDateTime);
+                hash.Add(data.lastWriteTime.lowDateTime);
+            }
+        }
+
+        // hash of everything the table depends on
+        [[nodiscard]] static std::uint64_t ComputeCacheKey() {
+            Fnv1a hash;
+            hash.Add(cacheVersion);
+            hash.Add(REL::Module::get().version().pack());
+            hash.Add(SKSE::PluginDeclaration::GetSingleton()->GetVersion().pack());
+
             const auto dataHandler = RE::TESDataHandler::GetSingleton();
             if (dataHandler) {
-                for (const auto& npc : dataHandler->GetFormArray<RE::TESNPC>()) {
-                    if (npc && npc->HasPCLevelMult()) {
-                        uint16_t originalMin = 0;
-                        uint16_t originalMax = 0;
-                        auto baseFormID = npc->GetFormID();
-                        if (originalActorBaseLevels.find(baseFormID) != originalActorBaseLevels.end()) {
-                            auto& tmp = originalActorBaseLevels.at(baseFormID);
-                            if (npc->actorData.calcLevelMin != tmp.originalMin ||
-                                npc->actorData.calcLevelMax != tmp.originalMax) {
-                                npc->actorData.calcLevelMin = tmp.originalMin;
-                                npc->actorData.calcLevelMax = tmp.originalMax;
-                                count++;
-                            }
-                            total++;
-                        }
+                for (auto file : dataHandler->files) {
+                    if (!file || file->compileIndex == 0xFF) {
+                        continue;
                     }
+                    hash.Add(std::string_view(file->fileName));
+                    hash.Add(file->compileIndex);
+                    hash.Add(file->smallFileCompileIndex);
+                    AddFileStamp(hash, file->fileData);
                 }
+                hash.Add(dataHandler->GetFormArray<RE::TESNPC>().size());
             }
-            logger::debug("Reset npc data for {} of {} npcs.", count, total);
+
+            auto settings = Settings::GetSingleton();
+            hash.Add(settings->usePluginFilter);
+            hash.Add(settings->pluginFilterInvert);
+            for (const auto* list : {&settings->pluginFilterMasterList, &settings->pluginFilterAnyList,
+                                     &settings->pluginFilterWinningList}) {
+                std::vector<std::string_view> names(list->begin(), list->end());
+                std::sort(names.begin(), names.end());
+                hash.Add(names.size());
+                for (auto name : names) {
+                    hash.Add(name);
+                }
+            }
+            return hash.Get();
         }
 
-        void ReadOriginalData() {
-            // Before any save is loaded all npc records are processed to store the original level values
-            // the original values are required for the lower and upper bounds
-            logger::debug("Initializing npc data...");
-            int count = 0;
+        [[nodiscard]] static std::uint64_t HashPayload(std::span<const std::byte> payload) {
+            Fnv1a hash;
+            hash.Add(payload.data(), payload.size());
+            return hash.Get();
+        }
+
+        bool ReadCache(std::uint64_t key) {
+            MappedFile file(cachePath);
+            auto data = file.Data();
+            if (data.size() < sizeof(CacheHeader)) {
+                return false;
+            }
+            CacheHeader header;
+            std::memcpy(&header, data.data(), sizeof(header));
+            auto payload = data.subspan(sizeof(header));
+            if (header.magic != cacheMagic || header.version != cacheVersion || header.key != key ||
+                payload.size() != header.count * cacheEntrySize || header.payloadHash != HashPayload(payload)) {
+                logger::debug("Npc data cache is outdated.");
+                return false;
+            }
+
+            std::size_t count = header.count;
+            auto read = [&](auto& vector) {
+                vector.resize(count);
+                auto bytes = count * sizeof(vector[0]);
+                std::memcpy(vector.data(), payload.data(), bytes);
+                payload = payload.subspan(bytes);
+            };
+            read(formIDs);
+            read(originalMin);
+            read(originalMax);
+            read(flags);
+            return true;
+        }
+
+        void WriteCache(std::uint64_t key) const {
+            std::vector<std::byte> payload;
+            payload.reserve(formIDs.size() * cacheEntrySize);
+            auto append = [&](const auto& vector) {
+                auto bytes = reinterpret_cast<const std::byte*>(vector.data());
+                payload.insert(payload.end(), bytes, bytes + vector.size() * sizeof(vector[0]));
+            };
+            append(formIDs);
+            append(originalMin);
+            append(originalMax);
+            append(flags);
+
+            CacheHeader header{cacheMagic, cacheVersion, key, HashPayload(payload),
+                               static_cast<std::uint32_t>(formIDs.size()), 0};
+
+            // write to a temporary file first, so an interrupted write never leaves a cache that looks valid
+            std::filesystem::path path(cachePath);
+            auto tempPath = path;
+            tempPath += L".tmp";
+            {
+                std::ofstream out(tempPath, std::ios::binary | std::ios::trunc);
+                out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+                out.write(reinterpret_cast<const char*>(payload.data()), payload.size());
+                if (!out) {
+                    logger::warn("Failed to write npc data cache.");
+                    return;
+                }
+            }
+            std::error_code ec;
+            std::filesystem::rename(tempPath, path, ec);
+            if (ec) {
+                logger::warn("Failed to write npc data cache: {}", ec.message());
+            }
+        }
+
+        void ResolvePluginFilter() {
+            auto settings = Settings::GetSingleton();
+            usePluginFilter = settings->usePluginFilter;
+            pluginFilterInvert = settings->pluginFilterInvert;
+            usePluginFilterAny = !settings->pluginFilterAnyList.empty();
+            pluginFilterMaster = {};
+            pluginFilterAny = {};
+            pluginFilterWinning = {};
+            if (!usePluginFilter) {
+                return;
+            }
             const auto dataHandler = RE::TESDataHandler::GetSingleton();
-            if (dataHandler) {
-                for (const auto& npc : dataHandler->GetFormArray<RE::TESNPC>()) {
-                    if (npc && npc->HasPCLevelMult()) {
-                        originalActorBaseLevels.insert_or_assign(
-                            npc->GetFormID(), actorbaseData{npc->actorData.calcLevelMin, npc->actorData.calcLevelMax});
+            if (!dataHandler) {
+                return;
+            }
+            for (auto file : dataHandler->files) {
+                if (!file || file->compileIndex == 0xFF) {
+                    continue;
+                }
+                std::string fileName = file->fileName;
+                if (settings->pluginFilterMasterList.contains(fileName)) {
+                    pluginFilterMaster.Set(file);
+                }
+                if (settings->pluginFilterAnyList.contains(fileName)) {
+                    pluginFilterAny.Set(file);
+                }
+                if (settings->pluginFilterWinningList.contains(fileName)) {
+                    pluginFilterWinning.Set(file);
+                }
+            }
+        }
+
+        [[nodiscard]] std::uint8_t ComputeFlags(TESNPC* base) const {
+            std::uint8_t result = 0;
+            if (base->HasPCLevelMult()) {
+                result |= kPCLevelMult;
+            }
+            if (base->actorData.actorBaseFlags & ACTOR_BASE_DATA::Flag::kUnique) {
+                result |= kUnique;
+            }
+            if (base->actorData.actorBaseFlags & ACTOR_BASE_DATA::Flag::kSummonable) {
+                result |= kSummonable;
+            }
+            if (PluginFilter(base)) {
+                result |= kPluginAllowed;
+            }
+            return result;
+        }
+
+        [[nodiscard]] bool PluginFilter(TESNPC* base) const {
+            if (!usePluginFilter) {
+                return true;
+            }
+            auto root = base->GetRootFaceNPC();
+            if (!root) {
+                logger::warn("Cannot find plugins referencing NPC. Plugin filter may not work as expected.");
+                logger::warn("NPC information: base id = {:X}", base->GetFormID());
+                return true;
+            }
+            auto filesArray = root->sourceFiles.array;
+            if (!filesArray || filesArray->empty()) {
+                logger::warn("Cannot find plugins referencing NPC. Plugin filter may not work as expected.");
+                logger::warn("NPC information: base id = {:X}, root id = {:X}", base->GetFormID(), root->GetFormID());
+                return true;
+            }
+            std::size_t first = 0;
+            std::size_t last = filesArray->size() - 1;
+            auto files = filesArray->data();
+
+            bool matched = pluginFilterMaster.Test(files[first]) || pluginFilterWinning.Test(files[last]);
+            if (!matched && usePluginFilterAny) {
+                for (std::size_t i = first; i <= last; i++) {
+                    if (pluginFilterAny.Test(files[i])) {
+                        matched = true;
+                        break;
+                    }
+                }
+            }
+            // by default matched npcs are filtered, if inverted only matched npcs are allowed
+            return matched == pluginFilterInvert;
+        }
+    };
+
+    // Counters and latency histograms (power of two nanosecond buckets) of the relevel pipeline
+    // Every thread writes its own counters without locks, they are summed when logged
+    class PerfCounters {
+    public:
+        enum Counter : std::uint8_t {
+            kSeen,
+            kFiltered,
+            kReleveled,
+            kReset,
+            kSkipped,
+            kStatDeferred,
+            kLockAcquired,
+            kLockContended,
+            kNumCounters
+        };
+
+        enum Histogram : std::uint8_t {
+            kProcessActor,
+            kLockWait,
+            kPendingQueueDelay,
+            kStatQueueDelay,
+            kStatBatch,
+            kStatMode0,
+            kStatMode1,
+            kStatMode2,
+            kNumHistograms
+        };
+
+        static PerfCounters* GetSingleton() {
+            static PerfCounters singleton;
+            return &singleton;
+        }
+
+        // Increments a counter for every event source in the mask.
+        void Count(Counter counter, std::uint8_t eventSources) {
+            auto& data = Local();
+            for (std::size_t i = 0; i < eventSourceNames.size(); ++i) {
+                if (eventSources & (1 << i)) {
+                    Increment(data.counters[i][counter], 1);
+                }
+            }
+        }
+
+        void Record(Histogram histogram, std::chrono::steady_clock::duration duration) {
+            auto nanoseconds = static_cast<std::uint64_t>(
+                std::max<std::int64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count(), 0));
+            auto bucket = std::min<std::size_t>(std::bit_width(nanoseconds), numBuckets - 1);
+            auto& data = Local();
+            Increment(data.buckets[histogram][bucket], 1);
+            Increment(data.totalNanoseconds[histogram], nanoseconds);
+        }
+
+        // for the pending actor queue, the only lock that event sinks on several threads compete for
+        template <class Mutex>
+        [[nodiscard]] std::unique_lock<Mutex> Acquire(Mutex& mutex, std::uint8_t eventSources) {
+            std::unique_lock<Mutex> lock(mutex, std::try_to_lock);
+            Count(kLockAcquired, eventSources);
+            if (!lock.owns_lock()) {
+                auto start = std::chrono::steady_clock::now();
+                lock.lock();
+                Record(kLockWait, std::chrono::steady_clock::now() - start);
+                Count(kLockContended, eventSources);
+            }
+            return lock;
+        }
+
+        // interval in seconds, 0 disables periodic logging
+        void LogIfDue(int interval) {
+            if (interval <= 0) {
+                return;
+            }
+            auto now = std::chrono::steady_clock::now().time_since_epoch();
+            auto last = lastLog.load(std::memory_order_relaxed);
+            if (now - std::chrono::steady_clock::duration(last) < std::chrono::seconds(interval)) {
+                return;
+            }
+            if (lastLog.compare_exchange_strong(last, now.count(), std::memory_order_relaxed)) {
+                Log();
+            }
+        }
+
+        void Log() {
+            std::lock_guard<std::mutex> guard(_threadsLock);
+            for (std::size_t i = 0; i < eventSourceNames.size(); ++i) {
+                std::array<std::uint64_t, kNumCounters> sums = {};
+                for (const auto& data : threads) {
+                    for (std::size_t counter = 0; counter < kNumCounters; ++counter) {
+                        sums[counter] += data->counters[i][counter].load(std::memory_order_relaxed);
+                    }
+                }
+                logger::debug(
+                    "{}: {} seen, {} filtered, {} releveled, {} reset, {} unchanged, {} stat recalculations deferred, "
+                    "{} of {} lock acquisitions contended.",
+                    eventSourceNames[i], sums[kSeen], sums[kFiltered], sums[kReleveled], sums[kReset], sums[kSkipped],
+                    sums[kStatDeferred], sums[kLockContended], sums[kLockAcquired]);
+            }
+            for (std::size_t histogram = 0; histogram < kNumHistograms; ++histogram) {
+                std::array<std::uint64_t, numBuckets> buckets = {};
+                std::uint64_t total = 0;
+                std::uint64_t count = 0;
+                for (const auto& data : threads) {
+                    for (std::size_t bucket = 0; bucket < numBuckets; ++bucket) {
+                        buckets[bucket] += data->buckets[histogram][bucket].load(std::memory_order_relaxed);
+                    }
+                    total += data->totalNanoseconds[histogram].load(std::memory_order_relaxed);
+                }
+                for (auto bucket : buckets) {
+                    count += bucket;
+                }
+                if (count == 0) {
+                    continue;
+                }
+                logger::debug("{}: {} samples, mean {} ns, p50 < {} ns, p99 < {} ns, max < {} ns.",
+                              histogramNames[histogram], count, total / count, Percentile(buckets, count, 0.5),
+                              Percentile(buckets, count, 0.99), Percentile(buckets, count, 1.0));
+            }
+        }
+
+    private:
+        static constexpr std::size_t numBuckets = 40;
+
+        static constexpr std::array<const char*, kNumHistograms> histogramNames = {
+            "ProcessActor", "Lock wait",    "Relevel queue delay", "Stat queue delay", "Stat batch",
+            "Stats mode 0", "Stats mode 1", "Stats mode 2"};
+
+        struct ThreadData {
+            std::array<std::array<std::atomic<std::uint64_t>, kNumCounters>, eventSourceNames.size()> counters = {};
+            std::array<std::array<std::atomic<std::uint64_t>, numBuckets>, kNumHistograms> buckets = {};
+            std::array<std::atomic<std::uint64_t>, kNumHistograms> totalNanoseconds = {};
+        };
+
+        std::mutex _threadsLock;
+        std::vector<std::unique_ptr<ThreadData>> threads;
+        std::atomic<std::int64_t> lastLog = 0;
+
+        PerfCounters() = default;
+
+        // only the owning thread writes, so a relaxed load and store is enough
+        static void Increment(std::atomic<std::uint64_t>& value, std::uint64_t amount) {
+            value.store(value.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+        }
+
+        ThreadData& Local() {
+            thread_local ThreadData* data = nullptr;
+            if (!data) {
+                std::lock_guard<std::mutex> guard(_threadsLock);
+                data = threads.emplace_back(std::make_unique<ThreadData>()).get();
+            }
+            return *data;
+        }
+
+        // upper bound of the bucket that contains the percentile
+        static std::uint64_t Percentile(const std::array<std::uint64_t, numBuckets>& buckets, std::uint64_t count,
+                                        double percentile) {
+            auto target = static_cast<std::uint64_t>(std::ceil(count * percentile));
+            std::uint64_t sum = 0;
+            for (std::size_t bucket = 0; bucket < numBuckets; ++bucket) {
+                sum += buckets[bucket];
+                if (sum >= target) {
+                    return std::uint64_t{1} << bucket;
+                }
+            }
+            return std::uint64_t{1} << (numBuckets - 1);
+        }
+    };
+
+    // Writes the inputs of the leveling math to a trace file, which can be replayed with the TraceReplay tool.
+    class TraceWriter {
+    public:
+        static TraceWriter* GetSingleton() {
+            static TraceWriter singleton;
+            return &singleton;
+        }
+
+        [[nodiscard]] bool IsEnabled() const { return enabled.load(std::memory_order_relaxed); }
+
+        void Start(const StatConstants& constants) {
+            constexpr auto path = L"Data/SKSE/Plugins/EnemiesRespectEncounterZones.trace";
+            std::lock_guard<std::mutex> guard(_lock);
+            out.open(path, std::ios::binary | std::ios::trunc);
+            if (!out) {
+                logger::warn("Failed to open trace file.");
+                return;
+            }
+            Trace::FileHeader header{Trace::magic, Trace::version};
+            out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+            WriteRecord(Trace::RecordType::kConstants, constants);
+            enabled.store(true, std::memory_order_relaxed);
+            logger::info("Capturing trace.");
+        }
+
+        template <typename T>
+        void Write(Trace::RecordType type, const T& record) {
+            std::lock_guard<std::mutex> guard(_lock);
+            WriteRecord(type, record);
+        }
+
+        void Flush() {
+            if (IsEnabled()) {
+                std::lock_guard<std::mutex> guard(_lock);
+                out.flush();
+            }
+        }
+
+    private:
+        std::atomic<bool> enabled = false;
+        std::mutex _lock;
+        std::ofstream out;
+
+        TraceWriter() = default;
+
+        template <typename T>
+        void WriteRecord(Trace::RecordType type, const T& record) {
+            static_assert(std::is_trivially_copyable_v<T>);
+            out.put(static_cast<char>(type));
+            out.write(reinterpret_cast<const char*>(&record), sizeof(record));
+        }
+    };
+
+    // Original and modified levels of dynamic npc records, in slots indexed by the lower 24 bits of the FormID
+    // Pages of slots are allocated on first use and released with their last entry
+    // Each slot remembers its record, so an entry is never used for another record with a recycled FormID
+    // The slots are only used on the main thread. Form delete events may come from any thread, so their evictions are
+    // queued under a lock and applied before the next main thread access
+    class DynamicLevelStore {
+    public:
+        struct Entry {
+            uint16_t originalMin;
+            uint16_t originalMax;
+            uint16_t modifiedMin;
+            uint16_t modifiedMax;
+        };
+
+        void Set(const TESNPC* base, const Entry& entry) {
+            ApplyEvictions();
+            auto formID = base->GetFormID();
+            auto& page = pages[PageIndex(formID)];
+            if (!page) {
+                page = std::make_unique<Page>();
+            }
+            auto& slot = page->slots[SlotIndex(formID)];
+            if (!slot.form) {
+                page->usedSlots++;
+                usedSlots++;
+            }
+            slot.form = base;
+            slot.entry = entry;
+        }
+
+        // If the slot belongs to another record or the levels were changed by something else, the entry is removed
+        [[nodiscard]] std::optional<Entry> GetValid(const TESNPC* base) {
+            ApplyEvictions();
+            auto formID = base->GetFormID();
+            auto& page = pages[PageIndex(formID)];
+            if (!page) {
+                return std::nullopt;
+            }
+            auto& slot = page->slots[SlotIndex(formID)];
+            if (!slot.form) {
+                return std::nullopt;
+            }
+            if (IsCurrent(slot, base)) {
+                return slot.entry;
+            }
+            Release(page, slot);
+            return std::nullopt;
+        }
+
+        // Like GetValid, but never removes the entry
+        [[nodiscard]] std::optional<Entry> Peek(const TESNPC* base) {
+            ApplyEvictions();
+            auto formID = base->GetFormID();
+            const auto& page = pages[PageIndex(formID)];
+            if (!page) {
+                return std::nullopt;
+            }
+            const auto& slot = page->slots[SlotIndex(formID)];
+            if (!slot.form || !IsCurrent(slot, base)) {
+                return std::nullopt;
+            }
+            return slot.entry;
+        }
+
+        // Removes the entry of a deleted record. Can be called on any thread.
+        void Evict(FormID formID) {
+            std::lock_guard<std::mutex> guard(_evictionLock);
+            evictions.push_back(formID);
+            evictionsPending.store(true, std::memory_order_release);
+        }
+
+        void Clear() {
+            {
+                std::lock_guard<std::mutex> guard(_evictionLock);
+                evictions.clear();
+                evictionsPending.store(false, std::memory_order_relaxed);
+            }
+            for (auto& page : pages) {
+                page.reset();
+            }
+            usedSlots = 0;
+        }
+
+        [[nodiscard]] std::size_t Size() {
+            ApplyEvictions();
+            return usedSlots;
+        }
+
+        template <typename Func>
+        void ForEach(Func&& func) {
+            ApplyEvictions();
+            for (std::size_t pageIndex = 0; pageIndex < pages.size(); ++pageIndex) {
+                const auto& page = pages[pageIndex];
+                if (!page) {
+                    continue;
+                }
+                for (std::size_t slotIndex = 0; slotIndex < pageSize; ++slotIndex) {
+                    const auto& slot = page->slots[slotIndex];
+                    if (slot.form) {
+                        func(static_cast<FormID>(0xff000000 | pageIndex * pageSize | slotIndex), slot.entry);
+                    }
+                }
+            }
+        }
+
+    private:
+        static constexpr std::size_t pageSize = 1024;
+        static constexpr std::size_t numPages = (1 << 24) / pageSize;
+
+        // form is null for unused slots
+        struct Slot {
+            Entry entry;
+            const TESNPC* form = nullptr;
+        };
+
+        struct Page {
+            std::array<Slot, pageSize> slots;
+            std::size_t usedSlots = 0;
+        };
+
+        std::array<std::unique_ptr<Page>, numPages> pages;
+        std::size_t usedSlots = 0;
+
+        std::mutex _evictionLock;
+        std::vector<FormID> evictions;
+        std::atomic<bool> evictionsPending = false;
+
+        static std::size_t PageIndex(FormID formID) { return (formID & 0xffffff) / pageSize; }
+        static std::size_t SlotIndex(FormID formID) { return formID % pageSize; }
+
+        static bool IsCurrent(const Slot& slot, const TESNPC* base) {
+            return slot.form == base && slot.entry.modifiedMin == base->actorData.calcLevelMin &&
+                   slot.entry.modifiedMax == base->actorData.calcLevelMax;
+        }
+
+        void ApplyEvictions() {
+            if (!evictionsPending.load(std::memory_order_acquire)) {
+                return;
+            }
+            std::lock_guard<std::mutex> guard(_evictionLock);
+            for (auto formID : evictions) {
+                auto& page = pages[PageIndex(formID)];
+                if (!page) {
+                    continue;
+                }
+                auto& slot = page->slots[SlotIndex(formID)];
+                if (slot.form) {
+                    Release(page, slot);
+                }
+            }
+            evictions.clear();
+            evictionsPending.store(false, std::memory_order_relaxed);
+        }
+
+        void Release(std::unique_ptr<Page>& page, Slot& slot) {
+            slot.form = nullptr;
+            usedSlots--;
+            if (--page->usedSlots == 0) {
+                page.reset();
+            }
+        }
+    };
+
+    // Resolved encounter zones per cell, or per reference for actors with their own zone data
+    // Entries remember the loaded cell data, so entries of reloaded cells are not used
+    class EncounterZoneCache {
+    public:
+        struct Zone {
+            BGSEncounterZone* encounterZone = nullptr;
+            const char* source = nullptr;
+            std::uint16_t minLevel = 0;
+            std::uint16_t maxLevel = 0;
+        };
+
+        Zone Resolve(Actor* actor, TESObjectCELL* cell, LOADED_CELL_DATA* loadedData) {
+            bool refSpecific = actor->extraList.HasType(ExtraDataType::kEncounterZone) ||
+                               actor->extraList.HasType(ExtraDataType::kPersistentCell);
+            auto handle = actor->GetHandle().native_handle();
+            {
+                std::shared_lock<std::shared_mutex> lock(_lock);
+                if (refSpecific) {
+                    auto entry = refZones.Find(handle);
+                    if (entry && entry->cell == cell && entry->loadedData == loadedData) {
+                        return entry->zone;
+                    }
+                } else {
+                    auto entry = cellZones.Find(cell);
+                    if (entry && entry->loadedData == loadedData) {
+                        return entry->zone;
+                    }
+                }
+            }
+
+            auto zone = ResolveUncached(actor, loadedData);
+            std::unique_lock<std::shared_mutex> lock(_lock);
+            if (refSpecific) {
+                refZones.InsertOrAssign(handle, Entry{zone, cell, loadedData});
+            } else {
+                cellZones.InsertOrAssign(cell, Entry{zone, cell, loadedData});
+            }
+            return zone;
+        }
+
+        void Invalidate(TESObjectREFR* ref) {
+            auto handle = ref->GetHandle().native_handle();
+            auto cell = ref->GetParentCell();
+            std::unique_lock<std::shared_mutex> lock(_lock);
+            refZones.Erase(handle);
+            if (cell) {
+                cellZones.Erase(cell);
+            }
+        }
+
+        void Clear() {
+            std::unique_lock<std::shared_mutex> lock(_lock);
+            cellZones.Clear();
+            refZones.Clear();
+        }
+
+    private:
+        struct Entry {
+            Zone zone;
+            TESObjectCELL* cell;
+            LOADED_CELL_DATA* loadedData;
+        };
+
+        mutable std::shared_mutex _lock;
+        // Clear keeps the capacity, so the maps only allocate until they reach the size of the largest cells
+        FlatMap<TESObjectCELL*, Entry> cellZones{256};
+        FlatMap<std::uint32_t, Entry> refZones{1024};
+
+        static Zone ResolveUncached(Actor* actor, LOADED_CELL_DATA* loadedData) {
+            Zone zone;
+
+            // 0x1E is a special encounter zone object that is used to indicate no EZ in some cases, treat same as no EZ
+            // at all
+
+            // priority:
+            // 1. regular GetEncounterZone function
+            // 2. read encounter zone from extra list
+            // 3. read encounter zone from cell
+
+            auto EZ = GetEncounterZone(actor);
+            if (EZ && EZ->GetFormID() != 0x1E) {
+                zone.source = "Encounter zone found with function";
+            } else {
+                EZ = actor->extraList.GetEncounterZone();
+                if (EZ && EZ->GetFormID() != 0x1E) {
+                    zone.source = "Encounter zone found in extra data";
+                } else {
+                    EZ = loadedData->encounterZone;
+                    if (EZ && EZ->GetFormID() != 0x1E) {
+                        zone.source = "Encounter zone found in cell data";
+                    } else {
+                        EZ = NULL;
+                    }
+                }
+            }
+
+            if (EZ) {
+                zone.encounterZone = EZ;
+                zone.minLevel = EZ->data.minLevel;
+                zone.maxLevel = EZ->data.maxLevel;
+                if (zone.minLevel < 1) {
+                    zone.minLevel = 1;
+                }
+                if (zone.maxLevel < 1) {
+                    zone.maxLevel = 0;
+                }
+            }
+            return zone;
+        }
+    };
+
+    // Precomputed level ranges for every pair of npc profile (original range and level) and zone range, including the
+    // iNoZoneMin/iNoZoneMax range. Dynamic npc records and unplanned zone ranges are calculated as before
+    class RelevelPlan {
+    public:
+        static constexpr std::uint32_t npos = std::numeric_limits<std::uint32_t>::max();
+
+        // The settings a plan depends on, copied so a build does not keep a settings snapshot in use
+        struct Options {
+            bool includeLevelMult = false;
+            bool extendLevels = false;
+            int noZoneMin = 0;
+            int noZoneMax = 0;
+        };
+
+        [[nodiscard]] static Options GetOptions(const Settings* settings) {
+            return Options{settings->includeLevelMult, settings->extendLevels, settings->noZoneMin,
+                           settings->noZoneMax};
+        }
+
+        // only reads data that does not change after loading, so it can run on a background thread
+        static std::unique_ptr<RelevelPlan> Build(const NpcTable& npcTable, const Options& options) {
+            auto start = std::chrono::steady_clock::now();
+            auto plan = std::unique_ptr<RelevelPlan>(new RelevelPlan());
+            plan->includeLevelMult = options.includeLevelMult;
+            plan->extendLevels = options.extendLevels;
+
+            // group npc records by original range and level
+            std::unordered_map<std::uint64_t, std::uint32_t> profileIndex;
+            std::vector<std::uint16_t> originalMin;
+            std::vector<std::uint16_t> originalMax;
+            std::vector<std::uint16_t> level;
+            plan->profileOf.assign(npcTable.Size(), npos);
+            for (std::uint32_t i = 0; i < npcTable.Size(); ++i) {
+                auto npc = TESForm::LookupByID<TESNPC>(npcTable.GetFormID(i));
+                if (!npc || !npc->HasPCLevelMult()) {
+                    continue;
+                }
+                std::uint16_t min = npcTable.GetOriginalMin(i);
+                std::uint16_t max = npcTable.GetOriginalMax(i);
+                if (min > max && max != 0) {
+                    max = min;
+                }
+                std::uint16_t npcLevel = npc->actorData.level;
+                auto key = static_cast<std::uint64_t>(min) << 32 | static_cast<std::uint64_t>(max) << 16 | npcLevel;
+                auto [it, inserted] = profileIndex.try_emplace(key, static_cast<std::uint32_t>(originalMin.size()));
+                if (inserted) {
+                    originalMin.push_back(min);
+                    originalMax.push_back(max);
+                    level.push_back(npcLevel);
+                }
+                plan->profileOf[i] = it->second;
+            }
+            plan->profileCount = originalMin.size();
+
+            // collect the distinct zone ranges, normalized like in ProcessActor and RelevelActorbase
+            std::vector<std::uint32_t> zoneKeys;
+            auto addZone = [&](std::uint16_t min, std::uint16_t max) {
+                if (min < 1) {
+                    min = 1;
+                }
+                if (max < 1) {
+                    max = 0;
+                }
+                if (min > max && max != 0) {
+                    max = min;
+                }
+                zoneKeys.push_back(ZoneKey(min, max));
+            };
+            addZone(static_cast<std::uint16_t>(options.noZoneMin), static_cast<std::uint16_t>(options.noZoneMax));
+            const auto dataHandler = RE::TESDataHandler::GetSingleton();
+            if (dataHandler) {
+                for (const auto& zone : dataHandler->GetFormArray<RE::BGSEncounterZone>()) {
+                    if (zone) {
+                        addZone(static_cast<std::uint16_t>(zone->data.minLevel),
+                                static_cast<std::uint16_t>(zone->data.maxLevel));
+                    }
+                }
+            }
+            std::sort(zoneKeys.begin(), zoneKeys.end());
+            zoneKeys.erase(std::unique(zoneKeys.begin(), zoneKeys.end()), zoneKeys.end());
+
+            // one batch per zone range over all profiles
+            plan->minLevels.resize(zoneKeys.size() * plan->profileCount);
+            plan->maxLevels.resize(zoneKeys.size() * plan->profileCount);
+            std::vector<std::uint16_t> zoneMin(plan->profileCount);
+            std::vector<std::uint16_t> zoneMax(plan->profileCount);
+            for (std::uint32_t row = 0; row < zoneKeys.size(); ++row) {
+                plan->zoneRows.emplace(zoneKeys[row], row);
+                std::fill(zoneMin.begin(), zoneMin.end(), static_cast<std::uint16_t>(zoneKeys[row] >> 16));
+                std::fill(zoneMax.begin(), zoneMax.end(), static_cast<std::uint16_t>(zoneKeys[row]));
+                LevelRangeBatch batch;
+                batch.minLevel = zoneMin.data();
+                batch.maxLevel = zoneMax.data();
+                batch.originalMin = originalMin.data();
+                batch.originalMax = originalMax.data();
+                batch.level = level.data();
+                batch.count = plan->profileCount;
+                batch.includeLevelMult = plan->includeLevelMult;
+                batch.extendLevels = plan->extendLevels;
+                auto offset = row * plan->profileCount;
+                ComputeLevelRanges(batch, plan->minLevels.data() + offset, plan->maxLevels.data() + offset);
+            }
+
+            auto duration =
+                std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+            logger::debug("Built relevel plan for {} npc profiles and {} zone ranges in {} us, using {} KiB.",
+                          plan->profileCount, zoneKeys.size(), duration.count(), plan->MemoryUsage() / 1024);
+            return plan;
+        }
+
+        [[nodiscard]] bool Matches(const Settings* settings) const {
+            return includeLevelMult == settings->includeLevelMult && extendLevels == settings->extendLevels;
+        }
+
+        // Returns the planned range of the npc record with the given table index in a zone range.
+        [[nodiscard]] std::optional<LevelRange> Find(std::uint32_t index, std::uint16_t minLevel,
+                                                     std::uint16_t maxLevel) const {
+            if (index >= profileOf.size() || profileOf[index] == npos) {
+                return std::nullopt;
+            }
+            auto it = zoneRows.find(ZoneKey(minLevel, maxLevel));
+            if (it == zoneRows.end()) {
+                return std::nullopt;
+            }
+            auto offset = it->second * profileCount + profileOf[index];
+            return LevelRange{minLevels[offset], maxLevels[offset]};
+        }
+
+        [[nodiscard]] std::size_t MemoryUsage() const {
+            return sizeof(*this) + profileOf.size() * sizeof(std::uint32_t) +
+                   (minLevels.size() + maxLevels.size()) * sizeof(std::uint16_t) +
+                   zoneRows.size() * (sizeof(std::uint32_t) * 2 + sizeof(void*) * 2);
+        }
+
+    private:
+        bool includeLevelMult = false;
+        bool extendLevels = false;
+        std::size_t profileCount = 0;
+        std::vector<std::uint32_t> profileOf;
+        std::unordered_map<std::uint32_t, std::uint32_t> zoneRows;
+        std::vector<std::uint16_t> minLevels;
+        std::vector<std::uint16_t> maxLevels;
+
+        RelevelPlan() = default;
+
+        static std::uint32_t ZoneKey(std::uint16_t minLevel, std::uint16_t maxLevel) {
+            return static_cast<std::uint32_t>(minLevel) << 16 | maxLevel;
+        }
+    };
+
+    class UnlevelManager {
+    public:
+        StatConstants statConstants;
+
+        static UnlevelManager* GetSingleton() {
+            static UnlevelManager singleton;
+            return &singleton;
+        }
+
+        struct actorbaseData {
+            uint16_t originalMin;
+            uint16_t originalMax;
+        };
+
+        void OnPreLoad() {
+            // Actors queued before the load refer to handles that are no longer valid
+            {
+                std::lock_guard<std::mutex> guard(_pendingLock);
+                pendingQueue.Clear();
+                pendingEventCount = 0;
+            }
+            {
+                std::lock_guard<std::mutex> guard(_statLock);
+                statQueue.clear();
+                statPending.store(false, std::memory_order_relaxed);
+            }
+            deferredStats.clear();
+            // When loading a save, reset all normal npc records
+            // This happens before dynamic npc records are created, which are based on the normal ones and will now also
+            // use the reset values
+            // Only records modified in this session or listed in the co-save of the loaded save are visited, unless the
+            // loaded save had no such list
+            ResetToOriginal(fullResetPending);
+            fullResetPending = false;
+            modifiedNpcsLoaded = false;
+            // Reset all dynamic data, as dynamic FormIDs are recycled, so they may now refer to different objects
+            logger::debug("Clearing level data of {} dynamic npcs.", dynamicActorBaseLevels.Size());
+            dynamicActorBaseLevels.Clear();
+            zoneCache.Clear();
+            batchedCells.Clear();
+            appliedRanges.Clear();
+            PerfCounters::GetSingleton()->Log();
+            TraceWriter::GetSingleton()->Flush();
+            Settings::LogDroppedMessages();
+        }
+
+        // dynamic npc records are saved with their modified levels, so the original levels go to the co-save
+        void OnGameSaved(SKSE::SerializationInterface* serialization) {
+            std::vector<SavedLevels> entries;
+            if (!Settings::GetSingleton()->manualUninstall) {
+                dynamicActorBaseLevels.ForEach([&](FormID formID, const DynamicLevelStore::Entry& entry) {
+                    entries.push_back(SavedLevels{formID, entry.originalMin, entry.originalMax, entry.modifiedMin,
+                                                  entry.modifiedMax});
+                });
+            }
+            auto count = static_cast<std::uint32_t>(entries.size());
+            if (!serialization->OpenRecord(Record_originalActorBaseLevels, Record_originalActorBaseLevelsVersion) ||
+                !serialization->WriteRecordData(count) ||
+                !serialization->WriteRecordData(entries.data(),
+                                                static_cast<std::uint32_t>(entries.size() * sizeof(SavedLevels)))) {
+                logger::error("Failed to write level data of {} dynamic npcs to the co-save.", count);
+                return;
+            }
+            logger::debug("Saved level data of {} dynamic npcs.", count);
+
+            // normal npc records are saved with their modified levels too, so the next load knows which to reset
+            std::vector<FormID> formIDs;
+            formIDs.reserve(modifiedNpcs.size());
+            for (const auto& [index, npc] : modifiedNpcs) {
+                formIDs.push_back(npc->GetFormID());
+            }
+            count = static_cast<std::uint32_t>(formIDs.size());
+            if (!serialization->OpenRecord(Record_modifiedNpcs, Record_modifiedNpcsVersion) ||
+                !serialization->WriteRecordData(count) ||
+                !serialization->WriteRecordData(formIDs.data(),
+                                                static_cast<std::uint32_t>(formIDs.size() * sizeof(FormID)))) {
+                logger::error("Failed to write {} modified npcs to the co-save.", count);
+                return;
+            }
+            logger::debug("Saved {} modified npcs.", count);
+        }
+
+        // entries are only restored if the npc record still has the saved modified levels
+        void OnGameLoaded(SKSE::SerializationInterface* serialization) {
+            std::uint32_t type;
+            std::uint32_t version;
+            std::uint32_t length;
+            while (serialization->GetNextRecordInfo(type, version, length)) {
+                if (type == Record_modifiedNpcs) {
+                    LoadModifiedNpcs(serialization, version, length);
+                    continue;
+                }
+                if (type != Record_originalActorBaseLevels) {
+                    logger::warn("Skipping unknown co-save record {:08X}.", type);
+                    continue;
+                }
+                if (version != Record_originalActorBaseLevelsVersion) {
+                    logger::warn("Skipping co-save record with unsupported version {}.", version);
+                    continue;
+                }
+                std::uint32_t count = 0;
+                if (length < sizeof(count) || serialization->ReadRecordData(count) != sizeof(count) ||
+                    length - sizeof(count) != static_cast<std::uint64_t>(count) * sizeof(SavedLevels)) {
+                    logger::warn("Skipping co-save record with invalid size {}.", length);
+                    continue;
+                }
+                std::vector<SavedLevels> entries(count);
+                auto size = static_cast<std::uint32_t>(count * sizeof(SavedLevels));
+                if (serialization->ReadRecordData(entries.data(), size) != size) {
+                    logger::warn("Skipping incomplete co-save record.");
+                    continue;
+                }
+                std::uint32_t restored = 0;
+                for (const auto& saved : entries) {
+                    FormID formID;
+                    if (!serialization->ResolveFormID(saved.formID, formID) || formID < 0xff000000) {
+                        continue;
+                    }
+                    auto base = TESForm::LookupByID<TESNPC>(formID);
+                    if (!base || base->actorData.calcLevelMin != saved.modifiedMin ||
+                        base->actorData.calcLevelMax != saved.modifiedMax) {
+                        continue;
+                    }
+                    dynamicActorBaseLevels.Set(base, DynamicLevelStore::Entry{saved.originalMin, saved.originalMax,
+                                                                              saved.modifiedMin, saved.modifiedMax});
+                    restored++;
+                }
+                logger::debug("Restored level data of {} of {} dynamic npcs.", restored, count);
+            }
+        }
+
+        void OnPostLoad() {
+            // a save without the list of modified npcs may still have levels of this plugin, e.g. from an older version
+            if (!modifiedNpcsLoaded) {
+                fullResetPending = true;
+            }
+            // after the save is loaded, levels are also loaded and need to be reset when uninstalling
+            // dynamic npcs can only be reset if their original levels were restored from the co-save, the others will
+            // keep their level until they respawn
+            auto settings = Settings::GetSingleton();
+            if (settings->manualUninstall) {
+                // the save may have levels from before the list of modified npcs was saved, so all records are checked
+                ResetToOriginal(true);
+                ResetDynamicToOriginal();
+                logger::info("Npc levels have been reset. Mod can be uninstalled now.");
+            }
+        }
+
+        void OnDataInit() {
+            npcTable.Build();
+            modifiedFlags.assign(npcTable.Size(), 0);
+            modifiedNpcs.clear();
+            auto gameSettings = GameSettingCollection::GetSingleton();
+            statConstants.skillsPerLevelUp = gameSettings->GetSetting("iAVDskillsLevelUp")->GetSInt();
+            EREZ_TRACE("iAVDskillsLevelUp = {}", statConstants.skillsPerLevelUp);
+            statConstants.skillsBase = gameSettings->GetSetting("iAVDSkillStart")->GetSInt();
+            EREZ_TRACE("iAVDSkillStart = {}", statConstants.skillsBase);
+            statConstants.attributesPerLevelUp = gameSettings->GetSetting("iAVDhmsLevelUp")->GetSInt();
+            EREZ_TRACE("iAVDhmsLevelUp = {}", statConstants.attributesPerLevelUp);
+            statConstants.healthLevelBonus = gameSettings->GetSetting("fNPCHealthLevelBonus")->GetFloat();
+            EREZ_TRACE("fNPCHealthLevelBonus = {}", statConstants.healthLevelBonus);
+
+            BuildRelevelPlan();
+
+            // the relevel path reuses its queues, so it stops allocating once they have their working size
+            {
+                std::lock_guard<std::mutex> guard(_pendingLock);
+                pendingQueue.Reserve(queueReserve);
+            }
+            processingActors.reserve(queueReserve);
+            processingCells.reserve(queueReserve);
+            cellActors.reserve(queueReserve);
+            batchedHandles.reserve(queueReserve);
+            relevelRecords.reserve(queueReserve);
+            {
+                std::lock_guard<std::mutex> guard(_statLock);
+                statQueue.reserve(queueReserve);
+            }
+            processingStats.reserve(queueReserve);
+            deferredStats.reserve(queueReserve);
+            scheduledStats.reserve(queueReserve);
+
+            if (Settings::GetSingleton()->captureTrace) {
+                TraceWriter::GetSingleton()->Start(statConstants);
+            }
+
+            if (Settings::GetSingleton()->watchSettings) {
+                SettingsWatcher::Start([]() {
+                    SKSE::GetTaskInterface()->AddTask([]() { UnlevelManager::GetSingleton()->ReloadSettings(); });
+                });
+            }
+        }
+
+        // runs as a task like the relevel path, so the npc table flags can be updated in place
+        void ReloadSettings() {
+            auto previous = Settings::GetSingleton();
+            logger::info("Reloading settings.");
+            auto settings = Settings::Reload();
+            if (!settings->SamePluginFilter(*previous)) {
+                npcTable.RefilterPlugins();
+                logger::info("Updated plugin filter.");
+            }
+            if (settings->includeLevelMult != previous->includeLevelMult ||
+                settings->extendLevels != previous->extendLevels || settings->noZoneMin != previous->noZoneMin ||
+                settings->noZoneMax != previous->noZoneMax) {
+                BuildRelevelPlan();
+            }
+            // applied ranges identify the settings by address, which a later snapshot may reuse
+            appliedRanges.Clear();
+        }
+
+    private:
+        // The npc table is read-only after OnDataInit, except for settings reloads, which run on the same task thread
+        // as the relevel path, so it needs no lock
+        NpcTable npcTable;
+
+        // The current relevel plan. Plans are built by one worker thread and swapped in by a task, so the swap runs on
+        // the main thread like every user of the plan, and the replaced plan is freed right away.
+        std::unique_ptr<RelevelPlan> relevelPlan;
+        std::mutex _planLock;
+        std::condition_variable_any planRequested;
+        std::optional<RelevelPlan::Options> planRequest;
+        // declared after the members the worker uses, so it is stopped and joined before they are destroyed
+        std::jthread planWorker;
+
+        DynamicLevelStore dynamicActorBaseLevels;
+        EncounterZoneCache zoneCache;
+
+        // Normal npc records whose levels were changed since the last reset, indexed by npc table index
+        // Only used on the main thread, by the relevel task and the load messages
+        std::vector<std::uint8_t> modifiedFlags;
+        std::vector<std::pair<std::uint32_t, TESNPC*>> modifiedNpcs;
+        // Set when the loaded save had no list of modified npcs, so the next reset has to check all records
+        bool fullResetPending = false;
+        bool modifiedNpcsLoaded = false;
+
+        // Actors waiting to be processed, collected from all event sinks until the next task queue drain
+        mutable std::mutex _pendingLock;
+        static constexpr std::size_t queueReserve = 1024;
+        PendingQueue pendingQueue{queueReserve};
+        std::vector<PendingActor> processingActors;
+        std::vector<FormID> processingCells;
+        std::size_t pendingEventCount = 0;
+        bool pendingFlushQueued = false;
+        std::chrono::steady_clock::time_point pendingQueuedAt;
+
+        // The last zone range and resulting base range applied for each actor handle. Only used by the task.
+        AppliedRangeCache appliedRanges;
+
+        // Cells that were processed as a batch with their current loaded data, and the actors processed by the cell
+        // batches of the current task. Only used by the task.
+        FlatMap<FormID, LOADED_CELL_DATA*> batchedCells{256};
+        std::vector<NiPointer<Actor>> cellActors;
+        std::vector<std::uint32_t> batchedHandles;
+
+        // Actors waiting for stat recalculation, processed as one batch per frame by the main loop hook. Actors left
+        // over when iStatBudgetMicroseconds is used up wait in deferredStats, which only the main thread uses.
+        mutable std::mutex _statLock;
+        std::vector<PendingActor> statQueue;
+        std::vector<PendingActor> processingStats;
+        std::vector<PendingActor> deferredStats;
+        std::atomic<bool> statPending = false;
+        std::chrono::steady_clock::time_point statQueuedAt;
+
+        struct ScheduledActor {
+            NiPointer<Actor> actor;
+            PendingActor pending;
+            bool inCombat;
+            float distance;
+        };
+
+        std::vector<ScheduledActor> scheduledStats;
+
+        // Level changes of the current task, sent to other plugins when the task is done
+        std::vector<EREZ_RelevelRecord> relevelRecords;
+        static_assert(sizeof(EREZ_RelevelRecord) == 20);
+
+        // co-save entry of a dynamic npc record
+        struct SavedLevels {
+            FormID formID;
+            std::uint16_t originalMin;
+            std::uint16_t originalMax;
+            std::uint16_t modifiedMin;
+            std::uint16_t modifiedMax;
+        };
+        static_assert(sizeof(SavedLevels) == 12);
+
+        // Values shared by all actors of a stat recalculation batch
+        struct StatContext {
+            int calculateStats;
+            bool smartStatsCalculate;
+            StatConstants constants;
+        };
+
+        // Requests a plan for the current settings from the plan worker, which is started with the first request
+        // Requests made while a plan is being built replace each other, only the last one is built
+        void BuildRelevelPlan() {
+            {
+                std::lock_guard<std::mutex> guard(_planLock);
+                planRequest = RelevelPlan::GetOptions(Settings::GetSingleton());
+            }
+            planRequested.notify_one();
+            if (!planWorker.joinable()) {
+                planWorker = std::jthread([this](std::stop_token stop) { RunPlanWorker(stop); });
+            }
+        }
+
+        void RunPlanWorker(std::stop_token stop) {
+            while (true) {
+                RelevelPlan::Options options;
+                {
+                    std::unique_lock<std::mutex> lock(_planLock);
+                    if (!planRequested.wait(lock, stop, [this]() { return planRequest.has_value(); })) {
+                        return;
+                    }
+                    options = *planRequest;
+                    planRequest.reset();
+                }
+                auto plan = RelevelPlan::Build(npcTable, options).release();
+                // tasks run in order, so the plan of the last request is swapped in last
+                SKSE::GetTaskInterface()->AddTask(
+                    [plan]() { UnlevelManager::GetSingleton()->relevelPlan.reset(plan); });
+            }
+        }
+
+        void QueueStatRecalculation(std::uint32_t handle, std::uint8_t eventSources) {
+            std::lock_guard<std::mutex> guard(_statLock);
+            // duplicates are merged when the queue is processed, so queueing does not allocate per actor
+            statQueue.push_back(PendingActor{handle, eventSources});
+            if (!statPending.load(std::memory_order_relaxed)) {
+                statQueuedAt = std::chrono::steady_clock::now();
+                statPending.store(true, std::memory_order_release);
+            }
+        }
+
+        void RecalculateActorStats(Actor* actor, std::uint8_t eventSources, const StatContext& context) {
+            auto base = actor->GetActorBase();
+            if (!base) {
+                return;
+            }
+            auto npcClass = base->npcClass;
+            if (!npcClass) {
+                return;
+            }
+            EREZ_TRACE("Recalculating reference [{:X}]({}).   {}", actor->GetFormID(), actor->GetName(),
+                       GetEventSourceNames(eventSources));
+
+            auto attributes = RecalculateAttributes(actor, base, npcClass, context);
+
+            if (context.smartStatsCalculate) {
+                auto avOwner = actor->AsActorValueOwner();
+                auto correctHealth = avOwner->GetBaseActorValue(ActorValue::kHealth) == attributes[0];
+                if (correctHealth) {
+                    EREZ_TRACE("Stat recalculation not necessary, because health is already correct.");
+                    return;
+                }
+            }
+
+            auto start = std::chrono::steady_clock::now();
+            switch (context.calculateStats) {
+                case 0: {
+                    EREZ_TRACE("Stats recalculation is disabled.");
+                    break;
+                }
+                case 1: {
+                    EREZ_TRACE("Recalculating stats ...");
+                    RecalculateStats(actor, base, attributes, context);
+                    break;
+                }
+                case 2: {
+                    EREZ_TRACE("Using setlevel to trigger stat recalculation.");
+                    RunSetLevel(actor, base);
+                    break;
+                }
+                default: {
+                    return;
+                }
+            }
+            PerfCounters::GetSingleton()->Record(
+                static_cast<PerfCounters::Histogram>(PerfCounters::kStatMode0 + context.calculateStats),
+                std::chrono::steady_clock::now() - start);
+        }
+
+        // the setlevel command forces recalculation of attributes (health, magicka, stamina)
+        void RunSetLevel(Actor* actor, TESNPC* base) {
+            auto factory = IFormFactory::GetConcreteFormFactoryByType<Script>();
+            if (!factory) {
+                return;
+            }
+            auto consoleScript = factory->Create();
+            if (!consoleScript) {
+                return;
+            }
+            auto commandStr = "setlevel " + std::to_string(base->actorData.level) + " 0 " +
+                              std::to_string(base->actorData.calcLevelMin) + " " +
+                              std::to_string(base->actorData.calcLevelMax);
+            consoleScript->SetCommand(commandStr);
+            consoleScript->CompileAndRun(actor);
+            delete consoleScript;
+        }
+
+        void SetActorBaseData(TESNPC* base, uint16_t originalMin, uint16_t originalMax, uint16_t min, uint16_t max) {
+            auto baseFormID = base->GetFormID();
+            if (baseFormID >= 0xff000000) {
+                dynamicActorBaseLevels.Set(base, DynamicLevelStore::Entry{originalMin, originalMax, min, max});
+            } else {
+                MarkModified(base);
+            }
+            base->actorData.calcLevelMin = min;
+            base->actorData.calcLevelMax = max;
+        }
+
+        void MarkModified(TESNPC* base) {
+            auto index = npcTable.Find(base->GetFormID());
+            if (index != NpcTable::npos && !modifiedFlags[index]) {
+                modifiedFlags[index] = 1;
+                modifiedNpcs.emplace_back(index, base);
+            }
+        }
+
+        // the listed records were loaded with the levels of the save, so they are reset before the next load
+        void LoadModifiedNpcs(SKSE::SerializationInterface* serialization, std::uint32_t version,
+                              std::uint32_t length) {
+            if (version != Record_modifiedNpcsVersion) {
+                logger::warn("Skipping co-save record with unsupported version {}.", version);
+                return;
+            }
+            std::uint32_t count = 0;
+            if (length < sizeof(count) || serialization->ReadRecordData(count) != sizeof(count) ||
+                length - sizeof(count) != static_cast<std::uint64_t>(count) * sizeof(FormID)) {
+                logger::warn("Skipping co-save record with invalid size {}.", length);
+                return;
+            }
+            std::vector<FormID> formIDs(count);
+            auto size = static_cast<std::uint32_t>(count * sizeof(FormID));
+            if (serialization->ReadRecordData(formIDs.data(), size) != size) {
+                logger::warn("Skipping incomplete co-save record.");
+                return;
+            }
+            for (auto savedFormID : formIDs) {
+                FormID formID;
+                if (!serialization->ResolveFormID(savedFormID, formID)) {
+                    continue;
+                }
+                if (auto base = TESForm::LookupByID<TESNPC>(formID)) {
+                    MarkModified(base);
+                }
+            }
+            modifiedNpcsLoaded = true;
+            logger::debug("Loaded {} modified npcs, {} in total.", count, modifiedNpcs.size());
+        }
+
+        actorbaseData GetOriginalActorBaseData(TESNPC* base) {
+            auto baseFormID = base->GetFormID();
+            uint16_t originalMin = 0;
+            uint16_t originalMax = 0;
+
+            if (baseFormID >= 0xff000000) {
+                auto dynamicData = dynamicActorBaseLevels.GetValid(base);
+                if (!dynamicData) {
+                    originalMin = base->actorData.calcLevelMin;
+                    originalMax = base->actorData.calcLevelMax;
+                } else {
+                    originalMin = dynamicData->originalMin;
+                    originalMax = dynamicData->originalMax;
+                }
+            } else {
+                auto index = npcTable.Find(baseFormID);
+                if (index == NpcTable::npos) {
+                    originalMin = base->actorData.calcLevelMin;
+                    originalMax = base->actorData.calcLevelMax;
+                } else {
+                    originalMin = npcTable.GetOriginalMin(index);
+                    originalMax = npcTable.GetOriginalMax(index);
+                }
+            }
+            return actorbaseData{originalMin, originalMax};
+        }
+
+        // Only the records modified since the last reset are visited, unless fullScan is set
+        void ResetToOriginal(bool fullScan) {
+            logger::debug("Resetting npc data...");
+            int count = 0;
+            int total = 0;
+            if (!fullScan) {
+                for (const auto& [index, npc] : modifiedNpcs) {
+                    auto originalMin = npcTable.GetOriginalMin(index);
+                    auto originalMax = npcTable.GetOriginalMax(index);
+                    if (npc->actorData.calcLevelMin != originalMin || npc->actorData.calcLevelMax != originalMax) {
+                        npc->actorData.calcLevelMin = originalMin;
+                        npc->actorData.calcLevelMax = originalMax;
                         count++;
                     }
+                    modifiedFlags[index] = 0;
+                    total++;
                 }
+                modifiedNpcs.clear();
+                logger::debug("Reset npc data for {} of {} modified npcs.", count, total);
+                return;
             }
-            logger::debug("Initialized npc data for {} npcs.", count);
-        }
-
-        bool PluginFilter(Actor* actor, TESNPC* base) {
-            auto settings = Settings::GetSingleton();
-            if (!settings->usePluginFilter) {
-                return true;
-            }
-            auto root = base->GetRootFaceNPC();
-            if (root) {
-                auto filesArray = root->sourceFiles.array;
-                if (filesArray) {
-                    auto first = 0;
-                    auto last = filesArray->size() - 1;
-                    std::string fileNameMaster = filesArray->data()[first]->fileName;
-                    std::string fileNameWinning = filesArray->data()[last]->fileName;
-                    if (!settings->pluginFilterInvert) {
-                        if (settings->pluginFilterMasterList.find(fileNameMaster) !=
-                            settings->pluginFilterMasterList.end()) {
-                            return false;
-                        }
-                        if (settings->pluginFilterWinningList.find(fileNameWinning) !=
-                            settings->pluginFilterWinningList.end()) {
-                            return false;
-                        }
-                        if (settings->pluginFilterAnyList.size() > 0) {
-                            for (int i = first; i <= last; i++) {
-                                std::string fileNameAny = filesArray->data()[i]->fileName;
-                                if (settings->pluginFilterAnyList.find(fileNameAny) !=
-                                    settings->pluginFilterAnyList.end()) {
-                                    return false;
-                                }
-                            }
-                        }
-                    } else {
-                        bool include = false;
-                        if (settings->pluginFilterMasterList.find(fileNameMaster) !=
-                            settings->pluginFilterMasterList.end()) {
-                            include = true;
-                        } else {
-                            if (settings->pluginFilterWinningList.find(fileNameWinning) !=
-                                settings->pluginFilterWinningList.end()) {
-                                include = true;
-                            } else {
-                                if (settings->pluginFilterAnyList.size() > 0) {
-                                    for (int i = first; i <= last; i++) {
-                                        std::string fileNameAny = filesArray->data()[i]->fileName;
-                                        if (settings->pluginFilterAnyList.find(fileNameAny) !=
-                                            settings->pluginFilterAnyList.end()) {
-                                            include = true;
-                                            break;
-                                        }
-                                    }
-                                }
+            const auto dataHandler = RE::TESDataHandler::GetSingleton();
+            if (dataHandler) {
+                for (const auto& npc : dataHandler->GetFormArray<RE::TESNPC>()) {
+                    if (npc && npc->HasPCLevelMult()) {
+                        auto index = npcTable.Find(npc->GetFormID());
+                        if (index != NpcTable::npos && (npcTable.GetFlags(index) & NpcTable::kPCLevelMult)) {
+                            auto originalMin = npcTable.GetOriginalMin(index);
+                            auto originalMax = npcTable.GetOriginalMax(index);
+                            if (npc->actorData.calcLevelMin != originalMin ||
+                                npc->actorData.calcLevelMax != originalMax) {
+                                npc->actorData.calcLevelMin = originalMin;
+                                npc->actorData.calcLevelMax = originalMax;
+                                count++;
                             }
-                        }
-                        if (!include) {
-                            return false;
+                            total++;
                         }
                     }
-
-                } else {
-                    logger::warn("Cannot find plugins referencing NPC. Plugin filter may not work as expected.");
-                    logger::warn("NPC information: name = {}, ref id = {:X}, base id = {:X}, root id = {:X}",
-                                 actor->GetName(), actor->GetFormID(), base->GetFormID(), root->GetFormID());
                 }
-            } else {
-                logger::warn("Cannot find plugins referencing NPC. Plugin filter may not work as expected.");
-                logger::warn("NPC information: name = {}, ref id = {:X}, base id = {:X}", actor->GetName(),
-                             actor->GetFormID(), base->GetFormID());
             }
-            return true;
+            for (const auto& [index, npc] : modifiedNpcs) {
+                modifiedFlags[index] = 0;
+            }
+            modifiedNpcs.clear();
+            logger::debug("Reset npc data for {} of {} npcs.", count, total);
         }
 
-        bool StaticFilter(Actor* actor, TESNPC* base) {
-            if (!base->HasPCLevelMult()) {
-                // only consider player-leveled npcs
-                return false;
-            }
-            return PluginFilter(actor, base);
+        // Restores the dynamic npc records that still have the levels set by this plugin, then forgets them
+        void ResetDynamicToOriginal() {
+            int count = 0;
+            dynamicActorBaseLevels.ForEach([&](FormID formID, const DynamicLevelStore::Entry& entry) {
+                auto base = TESForm::LookupByID<TESNPC>(formID);
+                if (base && base->actorData.calcLevelMin == entry.modifiedMin &&
+                    base->actorData.calcLevelMax == entry.modifiedMax) {
+                    base->actorData.calcLevelMin = entry.originalMin;
+                    base->actorData.calcLevelMax = entry.originalMax;
+                    count++;
+                }
+            });
+            dynamicActorBaseLevels.Clear();
+            logger::debug("Reset npc data for {} dynamic npcs.", count);
         }
 
-        bool Filter(Actor* actor, TESNPC* base) {
-            auto settings = Settings::GetSingleton();
-            if (!settings->relevelUniques && (base->actorData.actorBaseFlags & ACTOR_BASE_DATA::Flag::kUnique)) {
+        bool Filter(Actor* actor, std::uint8_t npcFlags, const Settings* settings) {
+            if (!settings->relevelUniques && (npcFlags & NpcTable::kUnique)) {
                 return false;
             }
             auto owner = actor->GetCommandingActor().get();
             // only treat summons that are their own forms (kSummonable) as summons
             // other summons are likely reanimated and should not be treated differently, otherwise regular NPCs of the
             // same form id will cause conflicts
-            if (owner != NULL && base->actorData.actorBaseFlags & ACTOR_BASE_DATA::Flag::kSummonable) {
+            if (owner != NULL && npcFlags & NpcTable::kSummonable) {
                 if (!settings->relevelSummons) {
                     return false;
                 }
                 if (settings->treatSummonsLikeOwner) {
-                    if (!Filter(owner, owner->GetActorBase())) {
+                    auto ownerBase = owner->GetActorBase();
+                    if (ownerBase && !Filter(owner, npcTable.GetFlags(ownerBase), settings)) {
                         return false;
                     }
                 }
@@ -493,68 +2106,66 @@ namespace EREZ {
             return true;
         }
 
-        void ResetActorbase(TESNPC* base) {
+        // a reset is reported like a relevel without encounter zone
+        // Returns whether the levels were changed
+        bool ResetActorbase(Actor* actor, TESNPC* base) {
             auto baseFormID = base->GetFormID();
-            if (originalActorBaseLevels.find(baseFormID) != originalActorBaseLevels.end()) {
-                auto& tmp = originalActorBaseLevels.at(baseFormID);
-                if (base->actorData.calcLevelMin != tmp.originalMin ||
-                    base->actorData.calcLevelMin != tmp.originalMin) {
-                    logger::trace("Resetting [{:X}]({}) to level range {}-{}.", baseFormID, base->GetName(),
-                                  tmp.originalMin, tmp.originalMax);
-                    base->actorData.calcLevelMin = tmp.originalMin;
-                    base->actorData.calcLevelMax = tmp.originalMax;
+            auto index = npcTable.Find(baseFormID);
+            if (index != NpcTable::npos && (npcTable.GetFlags(index) & NpcTable::kPCLevelMult)) {
+                auto originalMin = npcTable.GetOriginalMin(index);
+                auto originalMax = npcTable.GetOriginalMax(index);
+                if (base->actorData.calcLevelMin != originalMin || base->actorData.calcLevelMax != originalMax) {
+                    EREZ_TRACE("Resetting [{:X}]({}) to level range {}-{}.", baseFormID, base->GetName(),
+                               originalMin, originalMax);
+                    auto oldMin = base->actorData.calcLevelMin;
+                    auto oldMax = base->actorData.calcLevelMax;
+                    base->actorData.calcLevelMin = originalMin;
+                    base->actorData.calcLevelMax = originalMax;
+                    RecordRelevel(actor, base, 0, oldMin, oldMax);
+                    return true;
                 }
             }
+            return false;
         }
 
-        std::array<std::int64_t, 3> RecalculateAttributes(Actor* actor, TESNPC* base, TESClass* npcClass) {
-            std::array<std::int64_t, 3> attributeValues = {};
-
-            auto level = actor->GetLevel();
-            auto healthWeight = npcClass->data.attributeWeights.health;
-            auto magickaWeight = npcClass->data.attributeWeights.magicka;
-            auto staminaWeight = npcClass->data.attributeWeights.stamina;
-            auto totalWeight = healthWeight + magickaWeight + staminaWeight;
-
-            std::list<std::pair<int, int>> attributeIndices;
-            attributeIndices.push_back(std::make_pair(0, healthWeight));
-            attributeIndices.push_back(std::make_pair(1, magickaWeight));
-            attributeIndices.push_back(std::make_pair(2, staminaWeight));
-
-            attributeIndices.sort([&](const std::pair<int, int>& first, const std::pair<int, int>& second) {
-                auto comp = first.second - second.second;
-                if (comp != 0) {
-                    return comp > 0;
-                }
-                return (first.first - second.first) < 0;
-            });
+        void RecordRelevel(Actor* actor, TESNPC* base, FormID zoneFormID, std::uint16_t oldMin, std::uint16_t oldMax) {
+            relevelRecords.push_back(EREZ_RelevelRecord{actor->GetHandle().native_handle(), base->GetFormID(),
+                                                        zoneFormID, oldMin, oldMax, base->actorData.calcLevelMin,
+                                                        base->actorData.calcLevelMax});
+        }
 
-            auto totalAttributePoints = attributesPerLevelUp * (level - 1);
-            for (auto& pair : attributeIndices) {
-                auto index = pair.first;
-                auto weight = pair.second;
-                auto add = static_cast<std::int64_t>((1.0 * weight) / totalWeight * totalAttributePoints);
-                attributeValues[index] = add;
-                totalAttributePoints -= add;
-                totalWeight -= weight;
+        // listeners read the records in place
+        void DispatchRelevelRecords() {
+            if (relevelRecords.empty()) {
+                return;
             }
-
-            attributeValues[0] +=
-                base->actorData.healthOffset + actor->GetRace()->data.startingHealth + (level - 1) * healthLevelBonus;
-            attributeValues[1] += base->actorData.magickaOffset + actor->GetRace()->data.startingMagicka;
-            attributeValues[2] += base->actorData.staminaOffset + actor->GetRace()->data.startingStamina;
-
-            attributeValues[0] = std::max(attributeValues[0], 0ll);
-            attributeValues[1] = std::max(attributeValues[1], 0ll);
-            attributeValues[2] = std::max(attributeValues[2], 0ll);
-
-            return attributeValues;
+            auto size = static_cast<std::uint32_t>(relevelRecords.size() * sizeof(EREZ_RelevelRecord));
+            SKSE::GetMessagingInterface()->Dispatch(EREZ_MESSAGE_RELEVEL_BATCH_V1, relevelRecords.data(), size,
+                                                    nullptr);
+            relevelRecords.clear();
         }
 
-        void RecalculateStats(Actor* actor, TESNPC* base, const std::array<std::int64_t, 3>& attributes) {
-            auto level = actor->GetLevel();
+        std::array<std::int64_t, 3> RecalculateAttributes(Actor* actor, TESNPC* base, TESClass* npcClass,
+                                                          const StatContext& context) {
+            auto race = actor->GetRace();
+            AttributeInput input;
+            input.level = actor->GetLevel();
+            input.weights = {npcClass->data.attributeWeights.health, npcClass->data.attributeWeights.magicka,
+                             npcClass->data.attributeWeights.stamina};
+            input.offsets = {base->actorData.healthOffset, base->actorData.magickaOffset,
+                             base->actorData.staminaOffset};
+            input.raceStartingValues = {race->data.startingHealth, race->data.startingMagicka,
+                                        race->data.startingStamina};
+            auto traceWriter = TraceWriter::GetSingleton();
+            if (traceWriter->IsEnabled()) {
+                traceWriter->Write(Trace::RecordType::kAttributes, Trace::AttributeRecord{base->GetFormID(), input});
+            }
+            return CalculateAttributes(input, context.constants);
+        }
 
-            logger::trace("computing attributes ...");
+        void RecalculateStats(Actor* actor, TESNPC* base, const std::array<std::int64_t, 3>& attributes,
+                              const StatContext& context) {
+            EREZ_TRACE("computing attributes ...");
 
             auto avOwner = actor->AsActorValueOwner();
 
@@ -568,116 +2179,53 @@ namespace EREZ {
                 avOwner->SetBaseActorValue(ActorValue::kStamina, attributes[2]);
             }
 
-            logger::trace("computing skills ...");
-
-            std::uint8_t* skillWeights = reinterpret_cast<std::uint8_t*>(&base->npcClass->data.skillWeights);
-            std::uint32_t totalSkillWeights = 0;
-            for (std::size_t i = 0; i < 18; ++i) {
-                totalSkillWeights += skillWeights[i];
-            }
+            EREZ_TRACE("computing skills ...");
 
-            logger::trace("reading race bonus ...");
+            SkillInput input;
+            input.level = actor->GetLevel();
+            std::memcpy(input.weights.data(), &base->npcClass->data.skillWeights, numSkills);
 
-            std::vector<std::uint8_t> currentSkill(18, skillsBase);
-            for (std::size_t i = 0; i < actor->GetRace()->data.kNumSkillBoosts; ++i) {
-                auto bonus = actor->GetRace()->data.skillBoosts[i].bonus;
-                if (bonus != 0) {
-                    int index = actor->GetRace()->data.skillBoosts[i].skill.underlying() - 6;
-                    if (index >= 0 && index < 18) {
-                        currentSkill[index] = skillsBase + bonus;
-                        logger::trace("raceBonus[{}] = {}", index, bonus);
-                    } else {
-                        logger::warn("encountered invalid racial skill bonus index: {}", index);
-                    }
-                } else {
-                    int index = actor->GetRace()->data.skillBoosts[i].skill.underlying() - 6;
-                    logger::trace("0 bonus has index: {}", index);
+            auto race = actor->GetRace();
+            for (std::size_t i = 0; i < numSkillBoosts; ++i) {
+                auto& boost = race->data.skillBoosts[i];
+                input.raceBoosts[i] = SkillBoost{boost.skill.underlying(), boost.bonus};
+                int index = boost.skill.underlying() - firstSkillActorValue;
+                if (boost.bonus != 0 && (index < 0 || index >= static_cast<int>(numSkills))) {
+                    logger::warn("encountered invalid racial skill bonus index: {}", index);
                 }
             }
 
-            logger::trace("computing initial skill distribution...");
-
-            auto totalSkillPoints = skillsPerLevelUp * (level - 1);
-            auto remainingSkillPoints = totalSkillPoints;
-            std::list<std::pair<std::size_t, double>> sortedSkills;
-
-            for (std::size_t i = 0; i < 18; ++i) {
-                if (skillWeights[i] == 0) {
-                    continue;
-                }
-                auto add = 1.0 * totalSkillPoints * skillWeights[i] / totalSkillWeights;
-                auto addFloored = static_cast<int>(add);
-
-                auto addLimited = std::min(addFloored, 100 - currentSkill[i]);
-                currentSkill[i] += addLimited;
-                remainingSkillPoints -= addLimited;
+            auto traceWriter = TraceWriter::GetSingleton();
+            if (traceWriter->IsEnabled()) {
+                traceWriter->Write(Trace::RecordType::kSkills, Trace::SkillRecord{base->GetFormID(), input});
+            }
+            auto currentSkill = CalculateSkills(input, context.constants);
+            for (std::size_t i = 0; i < numSkills; ++i) {
+                avOwner->SetBaseActorValue(static_cast<ActorValue>(i + firstSkillActorValue), currentSkill[i]);
+            }
+        }
 
-                if (currentSkill[i] < 100) {
-                    sortedSkills.push_back(std::make_pair(i, add - addFloored));
-                } else {
-                    // the formula on the wiki does not go into detail how skills are distributed once at least one
-                    // skill reaches 100 it seems that the skill points are redistributed to other skills, but in an
-                    // unexpected way to account for this weird behavior the following adjustments are made they are not
-                    // 100% accurate, but are closer to the real values than any reasonable algorithm I have found so
-                    // far
-                    auto over = std::lround((add - addLimited) /
-                                            (1.0 * skillsPerLevelUp * skillWeights[i] / totalSkillWeights));
-                    over = std::min(3l, over);
-                    remainingSkillPoints -= 4 * over - 2;
-                }
-            }
-
-            logger::trace("computing excess skill distribution...");
-
-            while (remainingSkillPoints > 0) {
-                sortedSkills.sort(
-                    [&](const std::pair<std::size_t, double>& first, const std::pair<std::size_t, double>& second) {
-                        auto comp = first.second - second.second;
-                        if (comp != 0) {
-                            return comp > 0;
-                        }
-                        comp = currentSkill[first.first] - currentSkill[second.first];
-                        if (comp != 0) {
-                            return comp < 0;
-                        }
-                        comp = first.first - second.first;
-                        return comp > 0;
-                    });
-                auto changed = false;
-                for (auto& p : sortedSkills) {
-                    auto i = p.first;
-                    if (currentSkill[i] < 100) {
-                        currentSkill[i]++;
-                        remainingSkillPoints--;
-                        changed = true;
-                        if (remainingSkillPoints == 0) {
-                            break;
-                        }
-                    }
-                }
-                if (!changed) {
-                    break;
+        // uses the relevel plan if it covers the npc record
+        LevelRange CalculateLevelRange(FormID baseFormID, const LevelRangeInput& input,
+                                       const Settings* settings) const {
+            auto plan = relevelPlan.get();
+            if (plan && plan->Matches(settings) && baseFormID < 0xff000000) {
+                auto planned = plan->Find(npcTable.Find(baseFormID), input.minLevel, input.maxLevel);
+                if (planned) {
+                    return *planned;
                 }
             }
-            for (std::size_t i = 0; i < 18; ++i) {
-                avOwner->SetBaseActorValue(static_cast<ActorValue>(i + 6), currentSkill[i]);
-            }
+            return ComputeLevelRange(input);
         }
 
-        void RelevelActorbase(TESNPC* base, uint16_t minLevel, uint16_t maxLevel) {
+        void RelevelActorbase(TESNPC* base, uint16_t minLevel, uint16_t maxLevel, std::uint8_t npcFlags,
+                              std::uint8_t eventSources, const Settings* settings) {
             if (minLevel > maxLevel && maxLevel != 0) {
                 logger::warn("minLevel ({}) > maxLevel ({}), setting maxLevel to minLevel", minLevel, maxLevel);
                 maxLevel = minLevel;
             }
 
-            uint32_t level = (uint32_t)base->actorData.level;
-            auto settings = Settings::GetSingleton();
             auto baseFormID = base->GetFormID();
-            auto root = base->GetRootFaceNPC();
-            if (root == NULL) {
-                root = base;
-            }
-            float pcLevelMult = level * 0.001f;
             uint16_t originalMin = 0;
             uint16_t originalMax = 0;
 
@@ -692,63 +2240,208 @@ namespace EREZ {
                 originalMax = originalMin;
             }
 
-            // use float for calculations
-            float minTmp = minLevel;
-            float maxTmp = maxLevel;
+            LevelRangeInput input;
+            input.minLevel = minLevel;
+            input.maxLevel = maxLevel;
+            input.originalMin = originalMin;
+            input.originalMax = originalMax;
+            input.level = base->actorData.level;
+            input.includeLevelMult = settings->includeLevelMult;
+            input.extendLevels = settings->extendLevels;
+            auto traceWriter = TraceWriter::GetSingleton();
+            if (traceWriter->IsEnabled()) {
+                traceWriter->Write(Trace::RecordType::kRelevel,
+                                   Trace::RelevelRecord{baseFormID, eventSources, npcFlags, input});
+            }
+            auto range = CalculateLevelRange(baseFormID, input, settings);
+
+            // so far nothing was changed
+            // now perform relevel
+            SetActorBaseData(base, originalMin, originalMax, range.min, range.max);
+
+            EREZ_TRACE(
+                "    Relevel base [{:X}/{:X}]({}) from level range {}-{} to level range {}-{} using factor {} .",
+                baseFormID, base->GetRootFaceNPC() ? base->GetRootFaceNPC()->GetFormID() : baseFormID,
+                base->GetName(), originalMin, originalMax, base->actorData.calcLevelMin, base->actorData.calcLevelMax,
+                input.includeLevelMult ? input.level * 0.001f : 1.0f);
+        }
 
-            // player mult
-            float factor = 1.0;
-            if (settings->includeLevelMult) {
-                factor = pcLevelMult;
-                minTmp *= factor;
-                maxTmp *= factor;
+    public:
+        // All events for an actor until the queued task runs are merged into one work item
+        void QueueActor(Actor* actor, EventSource eventSource) {
+            if (!actor) {
+                return;
+            }
+            auto handle = actor->GetHandle().native_handle();
+            if (!handle) {
+                return;
+            }
+            auto eventMask = static_cast<std::uint8_t>(eventSource);
+            // actors attached with their cell are processed together with the whole cell
+            TESObjectCELL* cell = nullptr;
+            if (eventSource == EventSource::kCellAttach && Settings::GetSingleton()->cellBatch) {
+                cell = actor->GetParentCell();
+            }
+            bool queueFlush = false;
+            {
+                auto lock = PerfCounters::GetSingleton()->Acquire(_pendingLock, eventMask);
+                pendingEventCount++;
+                pendingQueue.PushActor(handle, eventMask);
+                if (cell) {
+                    pendingQueue.PushCell(cell->GetFormID());
+                }
+                if (!pendingFlushQueued) {
+                    pendingFlushQueued = true;
+                    pendingQueuedAt = std::chrono::steady_clock::now();
+                    queueFlush = true;
+                }
+            }
+            if (queueFlush) {
+                SKSE::GetTaskInterface()->AddTask([]() { UnlevelManager::GetSingleton()->ProcessPendingActors(); });
             }
+        }
 
-            if (!settings->extendLevels) {
-                if (originalMax == 0) {
-                    // original max level is unlimited -> only limit by originalMin
-                    minTmp = std::max(minTmp, originalMin * 1.0f);
-                    if (maxLevel == 0) {
-                        // if maxLevel is 0, there will be no maximum level
-                        maxTmp = 0;
-                    } else {
-                        maxTmp = std::max(maxTmp, originalMin * 1.0f);
-                    }
-                } else {
-                    // limit minTmp to original level range
-                    minTmp = std::min(std::max(minTmp, originalMin * 1.0f), originalMax * 1.0f);
-                    if (maxLevel == 0) {
-                        // if maxTmp == 0, max level is set as high as possible, which is originalMax
-                        maxTmp = originalMax;
-                    } else {
-                        // limit maxTmp to original level range
-                        maxTmp = std::min(std::max(maxTmp, originalMin * 1.0f), originalMax * 1.0f);
-                    }
+        void OnReferenceDetached(TESObjectREFR* ref) { zoneCache.Invalidate(ref); }
+
+        // Level range an npc record would get in an encounter zone, without changing anything
+        // Filters that depend on the actor (followers, summons) are not applied. Only called on the main thread
+        LevelRange QueryLevelRange(TESNPC* base, BGSEncounterZone* zone, const Settings* settings) {
+            if (!base) {
+                return LevelRange{0, 0};
+            }
+            uint16_t originalMin = base->actorData.calcLevelMin;
+            uint16_t originalMax = base->actorData.calcLevelMax;
+            auto baseFormID = base->GetFormID();
+            if (baseFormID >= 0xff000000) {
+                auto dynamicData = dynamicActorBaseLevels.Peek(base);
+                if (dynamicData) {
+                    originalMin = dynamicData->originalMin;
+                    originalMax = dynamicData->originalMax;
+                }
+            } else {
+                auto index = npcTable.Find(baseFormID);
+                if (index != NpcTable::npos) {
+                    originalMin = npcTable.GetOriginalMin(index);
+                    originalMax = npcTable.GetOriginalMax(index);
                 }
             }
-            uint16_t minNew = (uint16_t)minTmp;
-            uint16_t maxNew = (uint16_t)maxTmp;
+            if (originalMin > originalMax && originalMax != 0) {
+                originalMax = originalMin;
+            }
 
-            // limit to positive levels
-            if (minNew <= 0) {
-                minNew = 1;
+            if (zone && zone->GetFormID() == 0x1E) {
+                zone = nullptr;
             }
-            if (maxNew <= 0) {
-                maxNew = 0;
+            if (!NpcTable::IsEligible(npcTable.GetFlags(base)) || settings->manualUninstall ||
+                (!zone && settings->noZoneSkip)) {
+                return LevelRange{originalMin, originalMax};
             }
 
-            // so far nothing was changed
-            // now perform relevel
-            SetActorBaseData(base, originalMin, originalMax, minNew, maxNew);
+            // normalized like in ProcessActor and RelevelActorbase
+            uint16_t minEZ = zone ? zone->data.minLevel : settings->noZoneMin;
+            uint16_t maxEZ = zone ? zone->data.maxLevel : settings->noZoneMax;
+            if (minEZ < 1) {
+                minEZ = 1;
+            }
+            if (maxEZ < 1) {
+                maxEZ = 0;
+            }
+            if (minEZ > maxEZ && maxEZ != 0) {
+                maxEZ = minEZ;
+            }
 
-            logger::trace(
-                "    Relevel base [{:X}/{:X}]({}) from level range {}-{} to level range {}-{} using factor {} .",
-                baseFormID, root->GetFormID(), base->GetName(), originalMin, originalMax, base->actorData.calcLevelMin,
-                base->actorData.calcLevelMax, factor);
+            LevelRangeInput input;
+            input.minLevel = minEZ;
+            input.maxLevel = maxEZ;
+            input.originalMin = originalMin;
+            input.originalMax = originalMax;
+            input.level = base->actorData.level;
+            input.includeLevelMult = settings->includeLevelMult;
+            input.extendLevels = settings->extendLevels;
+            return CalculateLevelRange(baseFormID, input, settings);
         }
 
-    public:
-        void ProcessActor(Actor* actor, const char* eventName) {
+        void OnFormDeleted(FormID formID) {
+            if (formID >= 0xff000000) {
+                dynamicActorBaseLevels.Evict(formID);
+            }
+        }
+
+        void ProcessPendingActors() {
+            auto perfCounters = PerfCounters::GetSingleton();
+            std::size_t eventCount = 0;
+            {
+                std::lock_guard<std::mutex> guard(_pendingLock);
+                pendingQueue.Drain(processingActors, processingCells);
+                eventCount = pendingEventCount;
+                pendingEventCount = 0;
+                pendingFlushQueued = false;
+                perfCounters->Record(PerfCounters::kPendingQueueDelay,
+                                     std::chrono::steady_clock::now() - pendingQueuedAt);
+            }
+            auto settings = Settings::GetSingleton();
+            for (auto cellFormID : processingCells) {
+                ProcessCell(cellFormID, settings);
+            }
+            std::sort(batchedHandles.begin(), batchedHandles.end());
+
+            for (const auto& pending : processingActors) {
+                if (std::binary_search(batchedHandles.begin(), batchedHandles.end(), pending.handle)) {
+                    continue;
+                }
+                auto actor = Actor::LookupByHandle(pending.handle);
+                if (actor) {
+                    auto start = std::chrono::steady_clock::now();
+                    ProcessActor(actor.get(), pending.eventSources, settings);
+                    perfCounters->Record(PerfCounters::kProcessActor, std::chrono::steady_clock::now() - start);
+                }
+            }
+            EREZ_TRACE("Processed {} actors and {} cells for {} events.", processingActors.size(),
+                       processingCells.size(), eventCount);
+            processingActors.clear();
+            processingCells.clear();
+            batchedHandles.clear();
+            DispatchRelevelRecords();
+            perfCounters->LogIfDue(Settings::GetSingleton()->perfLogInterval);
+        }
+
+        // A cell is only processed once for the same loaded cell data, later actors are handled by their own events
+        void ProcessCell(FormID cellFormID, const Settings* settings) {
+            auto cell = TESForm::LookupByID<TESObjectCELL>(cellFormID);
+            if (!cell) {
+                return;
+            }
+            auto loadedData = cell->GetRuntimeData().loadedData;
+            if (!loadedData) {
+                return;
+            }
+            auto [batched, inserted] = batchedCells.TryEmplace(cellFormID);
+            if (!inserted && *batched == loadedData) {
+                return;
+            }
+            *batched = loadedData;
+
+            // collect the actors first, so the references of the cell are not locked while they are processed
+            cell->ForEachReference([&](TESObjectREFR& ref) {
+                if (ref.GetFormType() == FormType::ActorCharacter && !ref.IsDisabled() && !ref.IsDeleted()) {
+                    cellActors.emplace_back(static_cast<Actor*>(&ref));
+                }
+                return BSContainer::ForEachResult::kContinue;
+            });
+
+            auto perfCounters = PerfCounters::GetSingleton();
+            auto eventSources = static_cast<std::uint8_t>(EventSource::kCellAttach);
+            for (const auto& actor : cellActors) {
+                batchedHandles.push_back(actor->GetHandle().native_handle());
+                auto start = std::chrono::steady_clock::now();
+                ProcessActor(actor.get(), eventSources, settings);
+                perfCounters->Record(PerfCounters::kProcessActor, std::chrono::steady_clock::now() - start);
+            }
+            EREZ_TRACE("Processed {} actors of cell [{:X}].", cellActors.size(), cellFormID);
+            cellActors.clear();
+        }
+
+        void ProcessActor(Actor* actor, std::uint8_t eventSources, const Settings* settings) {
             if (!actor) {
                 return;
             }
@@ -756,14 +2449,19 @@ namespace EREZ {
             if (!base) {
                 return;
             }
-            if (!StaticFilter(actor, base)) {
+            auto npcFlags = npcTable.GetFlags(base);
+            if (!NpcTable::IsEligible(npcFlags)) {
                 return;
             }
-            auto settings = Settings::GetSingleton();
+            auto perfCounters = PerfCounters::GetSingleton();
+            perfCounters->Count(PerfCounters::kSeen, eventSources);
 
-            if (!Filter(actor, base) || settings->manualUninstall) {
+            if (!Filter(actor, npcFlags, settings) || settings->manualUninstall) {
                 // The actor might have been releveled earlier, because it changed follower state
-                ResetActorbase(base);
+                perfCounters->Count(PerfCounters::kFiltered, eventSources);
+                if (ResetActorbase(actor, base)) {
+                    perfCounters->Count(PerfCounters::kReset, eventSources);
+                }
                 return;
             }
 
@@ -776,42 +2474,19 @@ namespace EREZ {
             if (!loadedData) {
                 return;
             }
-            logger::trace("Releveling reference [{:X}]({}).   {}", actor->GetFormID(), actor->GetName(), eventName);
+            EREZ_TRACE("Releveling reference [{:X}]({}).   {}", actor->GetFormID(), actor->GetName(),
+                       GetEventSourceNames(eventSources));
 
-            std::string ezMessagePrefix;
-
-            // 0x1E is a special encounter zone object that is used to indicate no EZ in some cases, treat same as no EZ
-            // at all
-
-            // priority:
-            // 1. regular GetEncounterZone function
-            // 2. read encounter zone from extra list
-            // 3. read encounter zone from cell
-
-            auto EZ = GetEncounterZone(actor);
-            if (EZ && EZ->GetFormID() != 0x1E) {
-                ezMessagePrefix = "Encounter zone found with function";
-            } else {
-                EZ = actor->extraList.GetEncounterZone();
-                if (EZ && EZ->GetFormID() != 0x1E) {
-                    ezMessagePrefix = "Encounter zone found in extra data";
-                } else {
-                    EZ = loadedData->encounterZone;
-                    if (EZ && EZ->GetFormID() != 0x1E) {
-                        ezMessagePrefix = "Encounter zone found in cell data";
-                    } else {
-                        EZ = NULL;
-                    }
-                }
-            }
+            auto zone = zoneCache.Resolve(actor, cell, loadedData);
+            auto EZ = zone.encounterZone;
 
             if (!EZ) {
                 if (settings->noZoneSkip) {
-                    ResetActorbase(base);
-                    logger::trace("    No encounter zone found, skipping NPC.");
+                    if (ResetActorbase(actor, base)) {
+                        perfCounters->Count(PerfCounters::kReset, eventSources);
+                    }
+                    EREZ_TRACE("    No encounter zone found, skipping NPC.");
                     return;
-                } else {
-                    ezMessagePrefix = "No encounter zone found, using iNoZoneMin and iNoZoneMax instead";
                 }
             }
 
@@ -821,8 +2496,8 @@ namespace EREZ {
 
             // use encounter zone min/max, if valid
             if (EZ) {
-                minEZ = EZ->data.minLevel;
-                maxEZ = EZ->data.maxLevel;
+                minEZ = zone.minLevel;
+                maxEZ = zone.maxLevel;
             }
             if (minEZ < 1) {
                 minEZ = 1;
@@ -830,85 +2505,108 @@ namespace EREZ {
             if (maxEZ < 1) {
                 maxEZ = 0;
             }
-            std::string levelRange;
-            if (maxEZ == 0) {
-                levelRange = std::to_string(minEZ) + "+";
+            if (EZ) {
+                EREZ_TRACE("    {}: [{:X}] ({})", zone.source, EZ->GetFormID(), FormatLevelRange(minEZ, maxEZ));
             } else {
-                levelRange = std::to_string(minEZ) + "-" + std::to_string(maxEZ);
+                EREZ_TRACE("    No encounter zone found, using iNoZoneMin and iNoZoneMax instead: ({})",
+                           FormatLevelRange(minEZ, maxEZ));
             }
 
-            if (EZ) {
-                logger::trace("    {}: [{:X}] ({})", ezMessagePrefix, EZ->GetFormID(), levelRange);
-            } else {
-                logger::trace("    {}: ({})", ezMessagePrefix, levelRange);
+            // repeated events for an actor in the same zone would apply the same range again
+            auto handle = actor->GetHandle().native_handle();
+            AppliedRange range{actor->GetFormID(), base->GetFormID(), settings, minEZ, maxEZ,
+                               base->actorData.calcLevelMin, base->actorData.calcLevelMax};
+            if (appliedRanges.IsApplied(handle, range)) {
+                EREZ_TRACE("    Level range is already applied.");
+                perfCounters->Count(PerfCounters::kSkipped, eventSources);
+                return;
             }
 
-            std::lock_guard<std::mutex> guard(_lock);
-            RelevelActorbase(base, minEZ, maxEZ);
+            auto oldMin = base->actorData.calcLevelMin;
+            auto oldMax = base->actorData.calcLevelMax;
+            RelevelActorbase(base, minEZ, maxEZ, npcFlags, eventSources, settings);
+            RecordRelevel(actor, base, EZ ? EZ->GetFormID() : 0, oldMin, oldMax);
+            perfCounters->Count(PerfCounters::kReleveled, eventSources);
 
-            auto refID = actor->GetHandle().native_handle();
+            range.baseMin = base->actorData.calcLevelMin;
+            range.baseMax = base->actorData.calcLevelMax;
+            appliedRanges.Remember(handle, range);
 
-            SKSE::GetTaskInterface()->AddTask([refID, eventName]() {
-                auto actor = Actor::LookupByHandle(refID).get();
-                auto settings = Settings::GetSingleton();
-                if (!actor) {
-                    return;
-                }
-                auto base = actor->GetActorBase();
-                if (!base) {
-                    return;
-                }
-                auto npcClass = base->npcClass;
-                if (!npcClass) {
-                    return;
-                }
-                logger::trace("Recalculating reference [{:X}]({}).   {}", actor->GetFormID(), actor->GetName(),
-                              eventName);
+            QueueStatRecalculation(handle, eventSources);
+        }
 
-                auto attributes = UnlevelManager::GetSingleton()->RecalculateAttributes(actor, base, npcClass);
+        // Called by the main loop hook once per frame
+        void OnFrame() {
+            if (statPending.load(std::memory_order_acquire) || !deferredStats.empty()) {
+                ProcessStatQueue();
+            }
+        }
 
-                if (settings->smartStatsCalculate) {
-                    auto avOwner = actor->AsActorValueOwner();
-                    auto correctHealth = avOwner->GetBaseActorValue(ActorValue::kHealth) == attributes[0];
-                    if (correctHealth) {
-                        logger::trace("Stat recalculation not necessary, because health is already correct.");
-                        return;
-                    }
-                }
+        // Actors in combat go first, then actors closest to the player
+        // Actors left when iStatBudgetMicroseconds are used up are deferred to the next frame
+        void ProcessStatQueue() {
+            if (statPending.load(std::memory_order_acquire)) {
+                std::lock_guard<std::mutex> guard(_statLock);
+                processingStats.swap(statQueue);
+                statPending.store(false, std::memory_order_relaxed);
+                PerfCounters::GetSingleton()->Record(PerfCounters::kStatQueueDelay,
+                                                     std::chrono::steady_clock::now() - statQueuedAt);
+            }
+            processingStats.insert(processingStats.end(), deferredStats.begin(), deferredStats.end());
+            deferredStats.clear();
+            if (processingStats.empty()) {
+                return;
+            }
+            auto start = std::chrono::steady_clock::now();
 
-                switch (settings->calculateStats) {
-                    case 0: {
-                        logger::trace("Stats recalculation is disabled.");
-                        break;
-                    }
-                    case 1: {
-                        logger::trace("Recalculating stats ...");
-                        UnlevelManager::GetSingleton()->RecalculateStats(actor, base, attributes);
-                        break;
-                    }
-                    case 2: {
-                        logger::trace("Using setlevel to trigger stat recalculation.");
-                        auto factory = IFormFactory::GetConcreteFormFactoryByType<Script>();
-                        if (factory) {
-                            auto consoleScript = factory->Create();
-                            if (consoleScript) {
-                                // the setlevel command forces recalculation of attributes (health, magicka,
-                                // stamina)
-                                auto commandStr = "setlevel " + std::to_string(base->actorData.level) + " 0 " +
-                                                  std::to_string(base->actorData.calcLevelMin) + " " +
-                                                  std::to_string(base->actorData.calcLevelMax) + "";
-                                consoleScript->SetCommand(commandStr);
-                                consoleScript->CompileAndRun(actor);
-                                delete consoleScript;
-                            }
-                        }
-                        break;
-                    }
-                    default: {
-                        break;
-                    }
+            MergePendingActors(processingStats);
+
+            auto settings = Settings::GetSingleton();
+            const StatContext context{settings->calculateStats, settings->smartStatsCalculate, statConstants};
+
+            auto player = PlayerCharacter::GetSingleton();
+            auto playerPosition = player ? player->GetPosition() : NiPoint3();
+            for (const auto& pending : processingStats) {
+                auto actor = Actor::LookupByHandle(pending.handle);
+                if (actor) {
+                    auto distance = actor->GetPosition().GetSquaredDistance(playerPosition);
+                    auto inCombat = actor->IsInCombat();
+                    scheduledStats.push_back(ScheduledActor{std::move(actor), pending, inCombat, distance});
                 }
-            });
+            }
+            std::sort(scheduledStats.begin(), scheduledStats.end(),
+                      [](const ScheduledActor& first, const ScheduledActor& second) {
+                          if (first.inCombat != second.inCombat) {
+                              return first.inCombat;
+                          }
+                          return first.distance < second.distance;
+                      });
+
+            auto budget = std::chrono::microseconds(settings->statBudgetMicroseconds);
+            std::size_t processed = 0;
+            for (const auto& scheduled : scheduledStats) {
+                if (budget.count() > 0 && processed > 0 && std::chrono::steady_clock::now() - start >= budget) {
+                    break;
+                }
+                RecalculateActorStats(scheduled.actor.get(), scheduled.pending.eventSources, context);
+                processed++;
+            }
+
+            auto perfCounters = PerfCounters::GetSingleton();
+            for (std::size_t i = processed; i < scheduledStats.size(); ++i) {
+                deferredStats.push_back(scheduledStats[i].pending);
+                perfCounters->Count(PerfCounters::kStatDeferred, scheduledStats[i].pending.eventSources);
+            }
+
+            // runs every frame with queued stats, so the totals go to the periodic summary
+            auto duration = std::chrono::steady_clock::now() - start;
+            perfCounters->Record(PerfCounters::kStatBatch, duration);
+            EREZ_TRACE("Recalculated stats for {} actors in {} us, {} actors deferred.", processed,
+                       std::chrono::duration_cast<std::chrono::microseconds>(duration).count(),
+                       scheduledStats.size() - processed);
+            perfCounters->LogIfDue(settings->perfLogInterval);
+            processingStats.clear();
+            scheduledStats.clear();
         }
 
     private:
@@ -945,7 +2643,7 @@ namespace EREZ {
                         if (ref) {
                             auto actor = static_cast<Actor*>(ref);
                             if (actor) {
-                                UnlevelManager::GetSingleton()->ProcessActor(actor, "TESObjectLoadedEvent");
+                                UnlevelManager::GetSingleton()->QueueActor(actor, EventSource::kObjectLoaded);
                             }
                         }
                     }
@@ -977,7 +2675,7 @@ namespace EREZ {
                 if (ref && ref->GetFormType() == FormType::ActorCharacter) {
                     auto actor = static_cast<Actor*>(ref);
                     if (actor) {
-                        UnlevelManager::GetSingleton()->ProcessActor(actor, "TESInitScriptEvent");
+                        UnlevelManager::GetSingleton()->QueueActor(actor, EventSource::kInitScript);
                     }
                 }
             }
@@ -1003,13 +2701,13 @@ namespace EREZ {
         RE::BSEventNotifyControl ProcessEvent(
             const RE::TESCellAttachDetachEvent* a_event,
             RE::BSTEventSource<RE::TESCellAttachDetachEvent>* a_eventSource) override {
-            if (a_event->attached) {
-                auto& ref = a_event->reference;
-                if (ref && ref->GetFormType() == FormType::ActorCharacter) {
-                    auto actor = static_cast<Actor*>(ref.get());
-                    if (actor) {
-                        UnlevelManager::GetSingleton()->ProcessActor(actor, "TESCellAttachDetachEvent");
-                    }
+            auto& ref = a_event->reference;
+            if (ref && ref->GetFormType() == FormType::ActorCharacter) {
+                auto actor = static_cast<Actor*>(ref.get());
+                if (a_event->attached) {
+                    UnlevelManager::GetSingleton()->QueueActor(actor, EventSource::kCellAttach);
+                } else {
+                    UnlevelManager::GetSingleton()->OnReferenceDetached(actor);
                 }
             }
             return RE::BSEventNotifyControl::kContinue;
@@ -1039,7 +2737,7 @@ namespace EREZ {
                 if (ref && ref->GetFormType() == FormType::ActorCharacter) {
                     auto actor = static_cast<Actor*>(ref);
                     if (actor) {
-                        UnlevelManager::GetSingleton()->ProcessActor(actor, "TESMoveAttachDetachEvent");
+                        UnlevelManager::GetSingleton()->QueueActor(actor, EventSource::kMoveAttach);
                     }
                 }
             }
@@ -1051,15 +2749,128 @@ namespace EREZ {
         OnMoveAttachEventHandler() = default;
     };
 
+    class OnFormDeleteEventHandler : public RE::BSTEventSink<RE::TESFormDeleteEvent> {
+    public:
+        static OnFormDeleteEventHandler* GetSingleton() {
+            static OnFormDeleteEventHandler singleton;
+            return &singleton;
+        }
+
+        static void RegisterListener() {
+            RE::ScriptEventSourceHolder* eventHolder = RE::ScriptEventSourceHolder::GetSingleton();
+            eventHolder->AddEventSink(OnFormDeleteEventHandler::GetSingleton());
+        }
+
+        RE::BSEventNotifyControl ProcessEvent(const RE::TESFormDeleteEvent* a_event,
+                                              RE::BSTEventSource<RE::TESFormDeleteEvent>* a_eventSource) override {
+            if (a_event) {
+                UnlevelManager::GetSingleton()->OnFormDeleted(a_event->formID);
+            }
+            return RE::BSEventNotifyControl::kContinue;
+        }
+
+    private:
+        OnFormDeleteEventHandler() = default;
+    };
+
+    // Papyrus functions returning the level range an npc record would get in an encounter zone
+    // Ranges are returned as flat arrays of min and max levels
+    namespace Papyrus {
+        constexpr std::string_view scriptName = "EnemiesRespectEncounterZones";
+
+        void AppendLevelRange(std::vector<std::int32_t>& result, TESNPC* base, BGSEncounterZone* zone,
+                              const Settings* settings) {
+            auto range = UnlevelManager::GetSingleton()->QueryLevelRange(base, zone, settings);
+            result.push_back(range.min);
+            result.push_back(range.max);
+        }
+
+        std::vector<std::int32_t> GetLevelRange(StaticFunctionTag*, TESNPC* base, BGSEncounterZone* zone) {
+            std::vector<std::int32_t> result;
+            AppendLevelRange(result, base, zone, Settings::GetSingleton());
+            return result;
+        }
+
+        // a single zone is used for all npc records
+        std::vector<std::int32_t> GetLevelRanges(StaticFunctionTag*, std::vector<TESNPC*> bases,
+                                                 std::vector<BGSEncounterZone*> zones) {
+            std::vector<std::int32_t> result;
+            if (zones.size() != bases.size() && zones.size() != 1) {
+                logger::warn("GetLevelRanges called with {} npcs and {} encounter zones.", bases.size(), zones.size());
+                return result;
+            }
+            auto settings = Settings::GetSingleton();
+            result.reserve(bases.size() * 2);
+            for (std::size_t i = 0; i < bases.size(); ++i) {
+                AppendLevelRange(result, bases[i], zones.size() == 1 ? zones[0] : zones[i], settings);
+            }
+            return result;
+        }
+
+        // Returns the ranges of one npc record in each of the zones.
+        std::vector<std::int32_t> GetLevelRangesForZones(StaticFunctionTag*, TESNPC* base,
+                                                         std::vector<BGSEncounterZone*> zones) {
+            std::vector<std::int32_t> result;
+            auto settings = Settings::GetSingleton();
+            result.reserve(zones.size() * 2);
+            for (auto zone : zones) {
+                AppendLevelRange(result, base, zone, settings);
+            }
+            return result;
+        }
+
+        // Not callable from tasklets, so the VM runs them on the main thread, like the relevel task and settings
+        // reloads, which refilter the npc table and replace the settings and relevel plan
+        bool RegisterFunctions(BSScript::IVirtualMachine* vm) {
+            vm->RegisterFunction("GetLevelRange", scriptName, GetLevelRange, false);
+            vm->RegisterFunction("GetLevelRanges", scriptName, GetLevelRanges, false);
+            vm->RegisterFunction("GetLevelRangesForZones", scriptName, GetLevelRangesForZones, false);
+            return true;
+        }
+    }  // namespace Papyrus
+
+    // Drains the stat queue once per frame, after the update of the main loop
+    struct MainUpdateHook {
+        static void thunk(Main* main, float delta) {
+            func(main, delta);
+            UnlevelManager::GetSingleton()->OnFrame();
+        }
+        static inline REL::Relocation<decltype(thunk)> func;
+
+        static void Install() {
+            REL::Relocation<std::uintptr_t> target{RELOCATION_ID(35565, 36564), REL::Relocate(0x748, 0xC26)};
+            SKSE::AllocTrampoline(14);
+            func = SKSE::GetTrampoline().write_call<5>(target.address(), thunk);
+        }
+    };
+
     bool Init() {
+        auto serialization = SKSE::GetSerializationInterface();
+        serialization->SetUniqueID(SerializationID);
+        serialization->SetSaveCallback(
+            [](SKSE::SerializationInterface* a_intfc) { UnlevelManager::GetSingleton()->OnGameSaved(a_intfc); });
+        serialization->SetLoadCallback(
+            [](SKSE::SerializationInterface* a_intfc) { UnlevelManager::GetSingleton()->OnGameLoaded(a_intfc); });
+
         OnActorLoadedEventHandler::RegisterListener();
         OnScriptInitEventHandler::RegisterListener();
         OnCellAttachEventHandler::RegisterListener();
         OnMoveAttachEventHandler::RegisterListener();
+        OnFormDeleteEventHandler::RegisterListener();
+        MainUpdateHook::Install();
+
+        if (!SKSE::GetPapyrusInterface()->Register(Papyrus::RegisterFunctions)) {
+            logger::error("Failed to register Papyrus functions.");
+        }
         return true;
     }
 
+    void OnPluginsLoaded() { Settings::StartAsyncLogging(); }
     void OnDataInit() { UnlevelManager::GetSingleton()->OnDataInit(); }
     void OnPreLoad() { UnlevelManager::GetSingleton()->OnPreLoad(); }
     void OnPostLoad() { UnlevelManager::GetSingleton()->OnPostLoad(); }
+    void OnSave() {
+        PerfCounters::GetSingleton()->Log();
+        TraceWriter::GetSingleton()->Flush();
+    }
 }  // namespace EREZ
@@ -5,7 +5,9 @@ using namespace SKSE;
 
 namespace EREZ {
     bool Init();
+    void OnPluginsLoaded();
     void OnDataInit();
     void OnPreLoad();
     void OnPostLoad();
+    void OnSave();
 }  // namespace EREZ
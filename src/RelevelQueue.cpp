@@ -0,0 +1,72 @@
+#include "RelevelQueue.h"
+
+#include <algorithm>
+
+namespace EREZ {
+    PendingQueue::PendingQueue(std::size_t capacity) : index(capacity) {}
+
+    void PendingQueue::Reserve(std::size_t capacity) {
+        actors.reserve(capacity);
+        cells.reserve(capacity);
+        index.Reserve(capacity);
+    }
+
+    void PendingQueue::PushActor(std::uint32_t handle, std::uint8_t eventSources) {
+        auto [position, inserted] = index.TryEmplace(handle);
+        if (inserted) {
+            *position = actors.size();
+            actors.push_back(PendingActor{handle, eventSources});
+        } else {
+            actors[*position].eventSources |= eventSources;
+        }
+    }
+
+    // there are only a few cells per drain, so a linear search is enough
+    void PendingQueue::PushCell(std::uint32_t cellFormID) {
+        if (std::find(cells.begin(), cells.end(), cellFormID) == cells.end()) {
+            cells.push_back(cellFormID);
+        }
+    }
+
+    void PendingQueue::Drain(std::vector<PendingActor>& actorsOut, std::vector<std::uint32_t>& cellsOut) {
+        actorsOut.swap(actors);
+        cellsOut.swap(cells);
+        index.Clear();
+    }
+
+    void PendingQueue::Clear() {
+        actors.clear();
+        cells.clear();
+        index.Clear();
+    }
+
+    void MergePendingActors(std::vector<PendingActor>& actors) {
+        std::sort(actors.begin(), actors.end(),
+                  [](const PendingActor& first, const PendingActor& second) { return first.handle < second.handle; });
+        std::size_t unique = 0;
+        for (const auto& pending : actors) {
+            if (unique > 0 && actors[unique - 1].handle == pending.handle) {
+                actors[unique - 1].eventSources |= pending.eventSources;
+            } else {
+                actors[unique++] = pending;
+            }
+        }
+        actors.resize(unique);
+    }
+
+    AppliedRangeCache::AppliedRangeCache() : ranges(maxEntries) {}
+
+    bool AppliedRangeCache::IsApplied(std::uint32_t handle, const AppliedRange& range) {
+        auto last = ranges.Find(handle);
+        return last && *last == range;
+    }
+
+    void AppliedRangeCache::Remember(std::uint32_t handle, const AppliedRange& range) {
+        if (ranges.Size() >= maxEntries && !ranges.Find(handle)) {
+            ranges.Clear();
+        }
+        ranges.InsertOrAssign(handle, range);
+    }
+
+    void AppliedRangeCache::Clear() { ranges.Clear(); }
+}  // namespace EREZ
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "FlatMap.h"
+
+// Work queues of the relevel path without CommonLibSSE dependencies, so their allocations can be tested on any host.
+// None of them is synchronized. Once reserved, they only allocate when a batch is larger than the reserved size.
+namespace EREZ {
+    // An actor handle with the events that queued it
+    struct PendingActor {
+        std::uint32_t handle;
+        std::uint8_t eventSources;
+    };
+
+    // Actors and cells queued by the event sinks. All events of an actor until the next drain are merged into one item.
+    class PendingQueue {
+    public:
+        explicit PendingQueue(std::size_t capacity);
+
+        void Reserve(std::size_t capacity);
+
+        void PushActor(std::uint32_t handle, std::uint8_t eventSources);
+
+        void PushCell(std::uint32_t cellFormID);
+
+        // Swaps the queued items with the given vectors, which must be empty, so both sides keep their capacity
+        void Drain(std::vector<PendingActor>& actors, std::vector<std::uint32_t>& cells);
+
+        void Clear();
+
+    private:
+        std::vector<PendingActor> actors;
+        std::vector<std::uint32_t> cells;
+        FlatMap<std::uint32_t, std::size_t> index;
+    };
+
+    // Sorts the actors by handle and merges the events of duplicates, in place
+    void MergePendingActors(std::vector<PendingActor>& actors);
+
+    // A zone range and the resulting base range applied to an actor. The settings pointer only identifies the settings
+    // snapshot the range was calculated with.
+    struct AppliedRange {
+        std::uint32_t refFormID = 0;
+        std::uint32_t baseFormID = 0;
+        const void* settings = nullptr;
+        std::uint16_t zoneMin = 0;
+        std::uint16_t zoneMax = 0;
+        std::uint16_t baseMin = 0;
+        std::uint16_t baseMax = 0;
+
+        friend bool operator==(const AppliedRange&, const AppliedRange&) = default;
+    };
+
+    // The last range applied for each actor handle. The handle is reused for other references, so the reference is part
+    // of the range. The cache is cleared before it would have to grow.
+    class AppliedRangeCache {
+    public:
+        static constexpr std::size_t maxEntries = 1 << 14;
+
+        AppliedRangeCache();
+
+        [[nodiscard]] bool IsApplied(std::uint32_t handle, const AppliedRange& range);
+
+        void Remember(std::uint32_t handle, const AppliedRange& range);
+
+        void Clear();
+
+    private:
+        FlatMap<std::uint32_t, AppliedRange> ranges;
+    };
+}  // namespace EREZ
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cstdint>
+
+#include "LevelMath.h"
+
+// A trace file is a FileHeader followed by records, each a RecordType byte and the record struct
+// The structs only contain fixed size fields, so the layout is the same on Windows and Linux
+namespace EREZ::Trace {
+    inline constexpr std::uint32_t magic = 0x52545A45;  // "EZTR"
+    inline constexpr std::uint32_t version = 1;
+
+    enum class RecordType : std::uint8_t {
+        kConstants = 1,
+        kRelevel = 2,
+        kAttributes = 3,
+        kSkills = 4,
+    };
+
+    struct FileHeader {
+        std::uint32_t magic;
+        std::uint32_t version;
+    };
+
+    struct RelevelRecord {
+        std::uint32_t formID;
+        std::uint8_t eventSources;
+        std::uint8_t npcFlags;
+        LevelRangeInput input;
+    };
+
+    struct AttributeRecord {
+        std::uint32_t formID;
+        AttributeInput input;
+    };
+
+    struct SkillRecord {
+        std::uint32_t formID;
+        SkillInput input;
+    };
+
+    static_assert(sizeof(FileHeader) == 8);
+    static_assert(sizeof(StatConstants) == 16);
+    static_assert(sizeof(RelevelRecord) == 20);
+    static_assert(sizeof(AttributeRecord) == 36);
+    static_assert(sizeof(SkillRecord) == 80);
+}  // namespace EREZ::Trace
@@ -0,0 +1,190 @@
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+#include <random>
+#include <vector>
+
+#include "Check.h"
+#include "LevelMath.h"
+#include "RelevelQueue.h"
+
+// Every allocation of the process is counted, the checks compare the count before and after the steady state loops
+namespace {
+    std::atomic<std::size_t> allocations = 0;
+}
+
+void* operator new(std::size_t size) {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    if (auto memory = std::malloc(size ? size : 1)) {
+        return memory;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void* memory) noexcept { std::free(memory); }
+
+void operator delete(void* memory, std::size_t) noexcept { std::free(memory); }
+
+namespace {
+    using namespace EREZ;
+
+    // The capacity the plugin reserves for its queues, see UnlevelManager::OnDataInit
+    constexpr std::size_t queueReserve = 1024;
+
+    // Drains of up to queueReserve actors, queued with duplicates, checked against the applied ranges and queued again
+    // for stat recalculation, like ProcessPendingActors and ProcessStatQueue do
+    void CheckRelevelPathDoesNotAllocate() {
+        PendingQueue pendingQueue{queueReserve};
+        pendingQueue.Reserve(queueReserve);
+        std::vector<PendingActor> processingActors;
+        processingActors.reserve(queueReserve);
+        std::vector<std::uint32_t> processingCells;
+        processingCells.reserve(queueReserve);
+        std::vector<PendingActor> statQueue;
+        statQueue.reserve(queueReserve);
+        AppliedRangeCache appliedRanges;
+
+        std::mt19937 random(3);
+        std::uniform_int_distribution<std::uint32_t> handle(1, 1 << 20);
+        std::uniform_int_distribution<std::uint32_t> cell(1, 40);
+        std::uniform_int_distribution<int> level(1, 81);
+        std::uniform_int_distribution<std::size_t> drainSize(1, queueReserve);
+        int settings = 0;
+
+        auto before = allocations.load();
+        for (int drain = 0; drain < 2000; ++drain) {
+            auto count = drainSize(random);
+            for (std::size_t i = 0; i < count; ++i) {
+                auto actor = handle(random);
+                pendingQueue.PushActor(actor, 1);
+                // several events usually fire for the same actor
+                if (i % 3 == 0) {
+                    pendingQueue.PushActor(actor, 2);
+                }
+                if (i % 8 == 0) {
+                    pendingQueue.PushCell(cell(random));
+                }
+            }
+            pendingQueue.Drain(processingActors, processingCells);
+
+            for (const auto& pending : processingActors) {
+                LevelRangeInput input;
+                input.minLevel = static_cast<std::uint16_t>(level(random));
+                input.maxLevel = static_cast<std::uint16_t>(input.minLevel + level(random));
+                input.originalMin = 1;
+                input.originalMax = 0;
+                AppliedRange range{pending.handle, pending.handle, &settings, input.minLevel, input.maxLevel, 1, 0};
+                if (appliedRanges.IsApplied(pending.handle, range)) {
+                    continue;
+                }
+                auto result = ComputeLevelRange(input);
+                range.baseMin = result.min;
+                range.baseMax = result.max;
+                appliedRanges.Remember(pending.handle, range);
+                statQueue.push_back(pending);
+            }
+            processingActors.clear();
+            processingCells.clear();
+
+            MergePendingActors(statQueue);
+            statQueue.clear();
+        }
+        auto used = allocations.load() - before;
+        if (used != 0) {
+            std::fprintf(stderr, "relevel path: %zu allocations\n", used);
+        }
+        EREZ_CHECK(used == 0);
+    }
+
+    void CheckQueueMergesEvents() {
+        PendingQueue pendingQueue{8};
+        pendingQueue.PushActor(5, 1);
+        pendingQueue.PushActor(7, 1);
+        pendingQueue.PushActor(5, 4);
+        pendingQueue.PushCell(3);
+        pendingQueue.PushCell(3);
+        std::vector<PendingActor> actors;
+        std::vector<std::uint32_t> cells;
+        pendingQueue.Drain(actors, cells);
+        EREZ_CHECK(actors.size() == 2 && cells.size() == 1);
+        EREZ_CHECK(actors[0].handle == 5 && actors[0].eventSources == 5);
+        EREZ_CHECK(actors[1].handle == 7 && actors[1].eventSources == 1);
+
+        // the index was cleared with the drain
+        actors.clear();
+        cells.clear();
+        pendingQueue.PushActor(5, 2);
+        pendingQueue.Drain(actors, cells);
+        EREZ_CHECK(actors.size() == 1 && actors[0].eventSources == 2 && cells.empty());
+
+        std::vector<PendingActor> stats{{9, 1}, {2, 1}, {9, 2}, {2, 1}};
+        MergePendingActors(stats);
+        EREZ_CHECK(stats.size() == 2);
+        EREZ_CHECK(stats[0].handle == 2 && stats[0].eventSources == 1);
+        EREZ_CHECK(stats[1].handle == 9 && stats[1].eventSources == 3);
+    }
+
+    void CheckAppliedRangeCache() {
+        AppliedRangeCache appliedRanges;
+        AppliedRange range{1, 2, nullptr, 5, 10, 5, 10};
+        EREZ_CHECK(!appliedRanges.IsApplied(1, range));
+        appliedRanges.Remember(1, range);
+        EREZ_CHECK(appliedRanges.IsApplied(1, range));
+        auto otherRef = range;
+        otherRef.refFormID = 3;
+        EREZ_CHECK(!appliedRanges.IsApplied(1, otherRef));
+
+        // a full cache is cleared instead of growing
+        for (std::uint32_t handle = 2; handle <= AppliedRangeCache::maxEntries + 1; ++handle) {
+            appliedRanges.Remember(handle, range);
+        }
+        EREZ_CHECK(!appliedRanges.IsApplied(1, range));
+        EREZ_CHECK(appliedRanges.IsApplied(AppliedRangeCache::maxEntries + 1, range));
+    }
+
+    void CheckStatCalculationDoesNotAllocate() {
+        StatConstants constants{10, 5, 5, 15};
+        AttributeInput attributes;
+        attributes.weights = {3, 1, 2};
+        SkillInput skills;
+        for (std::size_t skill = 0; skill < numSkills; ++skill) {
+            skills.weights[skill] = static_cast<std::uint8_t>(skill % 4);
+        }
+        skills.raceBoosts[0] = SkillBoost{6, 10};
+
+        constexpr std::size_t count = 64;
+        std::vector<std::uint16_t> minLevel(count), maxLevel(count), originalMin(count), originalMax(count),
+            level(count), outMin(count), outMax(count);
+        for (std::uint16_t i = 0; i < count; ++i) {
+            minLevel[i] = static_cast<std::uint16_t>(1 + i);
+            maxLevel[i] = static_cast<std::uint16_t>(i % 3 ? 20 + i : 0);
+            originalMin[i] = 1;
+            originalMax[i] = static_cast<std::uint16_t>(i % 5 ? 40 : 0);
+            level[i] = 1000;
+        }
+        LevelRangeBatch batch{minLevel.data(), maxLevel.data(), originalMin.data(), originalMax.data(), level.data(),
+                              count, false, false};
+
+        std::uint64_t checksum = 0;
+        auto before = allocations.load();
+        for (std::uint16_t npcLevel = 1; npcLevel <= 100; ++npcLevel) {
+            attributes.level = npcLevel;
+            skills.level = npcLevel;
+            checksum += CalculateAttributes(attributes, constants)[0];
+            checksum += CalculateSkills(skills, constants)[6];
+            ComputeLevelRanges(batch, outMin.data(), outMax.data());
+            checksum += outMin[npcLevel % count];
+        }
+        EREZ_CHECK(allocations.load() == before);
+        EREZ_CHECK(checksum != 0);
+    }
+}  // namespace
+
+int main() {
+    CheckQueueMergesEvents();
+    CheckAppliedRangeCache();
+    CheckRelevelPathDoesNotAllocate();
+    CheckStatCalculationDoesNotAllocate();
+    return EREZ::Test::Result();
+}
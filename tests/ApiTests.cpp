@@ -0,0 +1,42 @@
+#include <cstdint>
+#include <random>
+#include <vector>
+
+#include "Check.h"
+#include "EREZ/API.h"
+
+namespace {
+    // The batch function against the single range function, with mixed flags and counts around the chunk size
+    void CheckBatchMatchesSingle() {
+        std::mt19937 random(16);
+        std::uniform_int_distribution<int> levelValue(0, 120);
+        std::uniform_int_distribution<int> playerLevelMult(0, 3000);
+        std::uniform_int_distribution<int> flag(0, 1);
+        for (std::uint32_t count : {0u, 1u, 7u, 255u, 256u, 257u, 1000u}) {
+            std::vector<EREZ_LevelRangeInput> inputs(count);
+            for (auto& input : inputs) {
+                input.minLevel = static_cast<std::uint16_t>(levelValue(random));
+                input.maxLevel = static_cast<std::uint16_t>(levelValue(random) < 20 ? 0 : levelValue(random));
+                input.originalMin = static_cast<std::uint16_t>(levelValue(random));
+                input.originalMax = static_cast<std::uint16_t>(levelValue(random) < 20 ? 0 : levelValue(random));
+                input.level = static_cast<std::uint16_t>(playerLevelMult(random));
+                input.includeLevelMult = static_cast<std::uint8_t>(flag(random));
+                input.extendLevels = static_cast<std::uint8_t>(flag(random) * 7);
+            }
+            std::vector<EREZ_LevelRange> outputs(count + 1, EREZ_LevelRange{0xBEEF, 0xBEEF});
+            EREZ_ComputeLevelRanges(inputs.data(), outputs.data(), count);
+            for (std::uint32_t i = 0; i < count; ++i) {
+                EREZ_LevelRange expected;
+                EREZ_ComputeLevelRange(&inputs[i], &expected);
+                EREZ_CHECK(outputs[i].min == expected.min && outputs[i].max == expected.max);
+            }
+            EREZ_CHECK(outputs[count].min == 0xBEEF && outputs[count].max == 0xBEEF);
+        }
+    }
+}  // namespace
+
+int main() {
+    EREZ_CHECK(EREZ_GetApiVersion() == EREZ_API_VERSION);
+    CheckBatchMatchesSingle();
+    return EREZ::Test::Result();
+}
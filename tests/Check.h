@@ -0,0 +1,25 @@
+#pragma once
+
+#include <cstdio>
+#include <cstdlib>
+
+// Minimal checks for the host-side tests, a failed check is reported and the test returns EXIT_FAILURE
+namespace EREZ::Test {
+    inline int failures = 0;
+
+    inline int Result() {
+        if (failures > 0) {
+            std::fprintf(stderr, "%d checks failed.\n", failures);
+            return EXIT_FAILURE;
+        }
+        return EXIT_SUCCESS;
+    }
+}  // namespace EREZ::Test
+
+#define EREZ_CHECK(condition)                                                                \
+    do {                                                                                     \
+        if (!(condition)) {                                                                  \
+            std::fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+            ++EREZ::Test::failures;                                                          \
+        }                                                                                    \
+    } while (false)
@@ -0,0 +1,97 @@
+#include <cstdint>
+#include <random>
+#include <unordered_map>
+
+#include "Check.h"
+#include "FlatMap.h"
+
+namespace {
+    using namespace EREZ;
+
+    // random operations compared against std::unordered_map
+    template <typename Key>
+    void CheckAgainstReference(std::mt19937& random, Key (*makeKey)(std::uint32_t), std::uint32_t keyRange) {
+        FlatMap<Key, std::uint32_t> map;
+        std::unordered_map<Key, std::uint32_t> reference;
+        std::uniform_int_distribution<std::uint32_t> key(1, keyRange);
+        std::uniform_int_distribution<int> operation(0, 99);
+        for (std::uint32_t i = 0; i < 200000; ++i) {
+            auto k = makeKey(key(random));
+            auto op = operation(random);
+            if (op < 45) {
+                auto [value, inserted] = map.TryEmplace(k);
+                auto [it, referenceInserted] = reference.try_emplace(k, 0);
+                EREZ_CHECK(inserted == referenceInserted);
+                EREZ_CHECK(*value == it->second);
+                *value = it->second = i;
+            } else if (op < 75) {
+                auto value = map.Find(k);
+                auto it = reference.find(k);
+                EREZ_CHECK((value != nullptr) == (it != reference.end()));
+                if (value && it != reference.end()) {
+                    EREZ_CHECK(*value == it->second);
+                }
+            } else if (op < 99) {
+                EREZ_CHECK(map.Erase(k) == (reference.erase(k) == 1));
+            } else {
+                map.Clear();
+                reference.clear();
+            }
+            EREZ_CHECK(map.Size() == reference.size());
+        }
+        std::size_t visited = 0;
+        map.ForEach([&](Key k, std::uint32_t value) {
+            auto it = reference.find(k);
+            EREZ_CHECK(it != reference.end() && it->second == value);
+            visited++;
+        });
+        EREZ_CHECK(visited == reference.size());
+    }
+
+    void CheckReuseKeepsCapacity() {
+        FlatMap<std::uint32_t, std::uint32_t> map;
+        map.Reserve(1000);
+        auto memory = map.MemoryUsage();
+        for (int round = 0; round < 10; ++round) {
+            for (std::uint32_t key = 1; key <= 1000; ++key) {
+                map.TryEmplace(key * 4096);
+            }
+            EREZ_CHECK(map.Size() == 1000);
+            map.Clear();
+            EREZ_CHECK(map.Empty());
+        }
+        EREZ_CHECK(map.MemoryUsage() == memory);
+
+        // a full map, with half of its 2048 slots used, only grows for new keys
+        for (std::uint32_t key = 1; key <= 1024; ++key) {
+            map.TryEmplace(key);
+        }
+        for (std::uint32_t key = 1; key <= 1024; ++key) {
+            map.InsertOrAssign(key, key);
+        }
+        EREZ_CHECK(map.MemoryUsage() == memory);
+        map.TryEmplace(1025);
+        EREZ_CHECK(map.MemoryUsage() > memory);
+        EREZ_CHECK(map.Find(500) && *map.Find(500) == 500);
+    }
+
+    void CheckEmptyKey() {
+        FlatMap<std::uint32_t, std::uint32_t> map;
+        EREZ_CHECK(map.Find(0) == nullptr);
+        EREZ_CHECK(!map.Erase(0));
+    }
+}  // namespace
+
+int main() {
+    std::mt19937 random(1);
+    // dense keys, like handles
+    CheckAgainstReference<std::uint32_t>(random, [](std::uint32_t k) { return k; }, 5000);
+    // keys that only differ in the upper bits, like FormIDs of different plugins
+    CheckAgainstReference<std::uint32_t>(random, [](std::uint32_t k) { return k << 20; }, 4000);
+    // pointers
+    CheckAgainstReference<const int*>(
+        random, [](std::uint32_t k) { return reinterpret_cast<const int*>(std::uintptr_t{k} * 64); }, 3000);
+    CheckReuseKeepsCapacity();
+    CheckEmptyKey();
+    return EREZ::Test::Result();
+}
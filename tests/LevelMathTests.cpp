@@ -0,0 +1,313 @@
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+#include "Check.h"
+#include "LevelMath.h"
+#include "ReferenceStats.h"
+
+namespace {
+    using namespace EREZ;
+
+    constexpr StatConstants gameConstants = {10, 5, 5, 15};
+
+    // a race with the usual +10 and six +5 boosts, starting at the given skill
+    std::array<SkillBoost, numSkillBoosts> MakeRace(std::int32_t firstSkill) {
+        std::array<SkillBoost, numSkillBoosts> boosts;
+        for (std::size_t i = 0; i < numSkillBoosts; ++i) {
+            boosts[i].skill = firstSkillActorValue + static_cast<std::int32_t>((firstSkill + i * 5) % numSkills);
+            boosts[i].bonus = i == 0 ? 10 : 5;
+        }
+        return boosts;
+    }
+
+    // every combination of attribute weights up to 15 at levels 1-100. The reference divides 0 by 0 for attributes
+    // without weight, so only attributes with weight are compared
+    void CheckAttributesMatchReference() {
+        AttributeInput input;
+        input.offsets = {-20, 5, 0};
+        input.raceStartingValues = {50.0f, 50.0f, 50.0f};
+        for (int health = 0; health < 16; ++health) {
+            for (int magicka = 0; magicka < 16; ++magicka) {
+                for (int stamina = 0; stamina < 16; ++stamina) {
+                    input.weights = {static_cast<std::uint8_t>(health), static_cast<std::uint8_t>(magicka),
+                                     static_cast<std::uint8_t>(stamina)};
+                    for (std::uint16_t level = 1; level <= 100; ++level) {
+                        input.level = level;
+                        auto actual = CalculateAttributes(input, gameConstants);
+                        auto expected = Test::ReferenceAttributes(input, gameConstants);
+                        for (std::size_t i = 0; i < numAttributes; ++i) {
+                            EREZ_CHECK(input.weights[i] == 0 || actual[i] == expected[i]);
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    // Properties of the level range over zone ranges, original ranges and level mults, with and without extendLevels
+    void CheckLevelRangeProperties() {
+        std::mt19937 random(12);
+        std::uniform_int_distribution<int> zoneLevel(0, 100);
+        std::uniform_int_distribution<int> originalLevel(0, 81);
+        std::uniform_int_distribution<int> playerLevelMult(0, 3000);
+        std::uniform_int_distribution<int> flags(0, 3);
+        for (int i = 0; i < 1000000; ++i) {
+            LevelRangeInput input;
+            input.minLevel = static_cast<std::uint16_t>(zoneLevel(random));
+            input.maxLevel = static_cast<std::uint16_t>(i % 4 == 0 ? 0 : zoneLevel(random));
+            input.originalMin = static_cast<std::uint16_t>(originalLevel(random));
+            input.originalMax = static_cast<std::uint16_t>(i % 3 == 0 ? 0 : originalLevel(random));
+            if (input.originalMax != 0 && input.originalMin > input.originalMax) {
+                std::swap(input.originalMin, input.originalMax);
+            }
+            input.level = static_cast<std::uint16_t>(playerLevelMult(random));
+            auto flag = flags(random);
+            input.includeLevelMult = flag & 1;
+            input.extendLevels = flag & 2;
+            auto range = ComputeLevelRange(input);
+
+            EREZ_CHECK(range.min >= 1);
+            if (input.extendLevels) {
+                // the zone range, only scaled by the level mult
+                if (!input.includeLevelMult) {
+                    EREZ_CHECK(range.min == std::max<std::uint16_t>(input.minLevel, 1));
+                    EREZ_CHECK(range.max == input.maxLevel);
+                }
+            } else if (input.originalMax == 0) {
+                // an unbounded original range only raises levels
+                EREZ_CHECK(range.min >= input.originalMin);
+                EREZ_CHECK(range.max == 0 || range.max >= input.originalMin);
+            } else {
+                // a bounded original range is never left, a zone without max uses the original max
+                EREZ_CHECK(range.min >= input.originalMin);
+                EREZ_CHECK(range.min <= std::max<std::uint16_t>(input.originalMax, 1));
+                EREZ_CHECK(range.max >= input.originalMin && range.max <= input.originalMax);
+                EREZ_CHECK(input.maxLevel != 0 || range.max == input.originalMax);
+            }
+            // a zone max of 0 never becomes a bounded range, unless the original range is bounded
+            if (input.maxLevel == 0 && (input.extendLevels || input.originalMax == 0)) {
+                EREZ_CHECK(range.max == 0);
+            }
+        }
+    }
+
+    // ComputeLevelRanges against ComputeLevelRange for counts around the vector widths, with unaligned arrays and
+    // for all flags. Outputs past count must not be written
+    void CheckLevelRangesMatchScalar() {
+        std::mt19937 random(15);
+        std::uniform_int_distribution<int> zoneLevel(0, 255);
+        std::uniform_int_distribution<int> originalLevel(0, 255);
+        std::uniform_int_distribution<int> playerLevelMult(0, 4000);
+        std::uniform_int_distribution<int> special(0, 7);
+        constexpr std::uint16_t sentinel = 0xBEEF;
+        for (std::size_t count : {0, 1, 7, 8, 15, 16, 17, 100000}) {
+            for (std::size_t offset : {0, 1}) {
+                std::vector<std::uint16_t> minLevel(count + offset), maxLevel(count + offset),
+                    originalMin(count + offset), originalMax(count + offset), level(count + offset);
+                for (std::size_t i = offset; i < count + offset; ++i) {
+                    minLevel[i] = static_cast<std::uint16_t>(special(random) == 0 ? 0 : zoneLevel(random));
+                    maxLevel[i] = static_cast<std::uint16_t>(special(random) <= 1 ? 0 : zoneLevel(random));
+                    originalMin[i] = static_cast<std::uint16_t>(special(random) == 0 ? 0 : originalLevel(random));
+                    originalMax[i] = static_cast<std::uint16_t>(special(random) <= 1 ? 0 : originalLevel(random));
+                    if (originalMax[i] != 0 && originalMin[i] > originalMax[i]) {
+                        std::swap(originalMin[i], originalMax[i]);
+                    }
+                    level[i] = static_cast<std::uint16_t>(special(random) == 0 ? 1000 : playerLevelMult(random));
+                }
+                for (int flags = 0; flags < 4; ++flags) {
+                    LevelRangeBatch batch;
+                    batch.minLevel = minLevel.data() + offset;
+                    batch.maxLevel = maxLevel.data() + offset;
+                    batch.originalMin = originalMin.data() + offset;
+                    batch.originalMax = originalMax.data() + offset;
+                    batch.level = level.data() + offset;
+                    batch.count = count;
+                    batch.includeLevelMult = flags & 1;
+                    batch.extendLevels = flags & 2;
+                    std::vector<std::uint16_t> outMin(count + 1, sentinel), outMax(count + 1, sentinel);
+                    ComputeLevelRanges(batch, outMin.data(), outMax.data());
+
+                    int mismatches = 0;
+                    for (std::size_t i = 0; i < count; ++i) {
+                        LevelRangeInput input;
+                        input.minLevel = batch.minLevel[i];
+                        input.maxLevel = batch.maxLevel[i];
+                        input.originalMin = batch.originalMin[i];
+                        input.originalMax = batch.originalMax[i];
+                        input.level = batch.level[i];
+                        input.includeLevelMult = batch.includeLevelMult;
+                        input.extendLevels = batch.extendLevels;
+                        auto range = ComputeLevelRange(input);
+                        if (outMin[i] != range.min || outMax[i] != range.max) {
+                            if (++mismatches <= 5) {
+                                std::fprintf(stderr, "ComputeLevelRanges differs at %zu of %zu with flags %d\n", i,
+                                             count, flags);
+                            }
+                        }
+                    }
+                    EREZ_CHECK(mismatches == 0);
+                    EREZ_CHECK(outMin[count] == sentinel && outMax[count] == sentinel);
+                }
+            }
+        }
+    }
+
+    // Points handed out by CalculateAttributes: all of them, none to attributes without weight, each within 2 points of
+    // its share by weight, and the racial starting values, offsets and the health bonus are added on top
+    void CheckAttributeProperties() {
+        std::mt19937 random(13);
+        std::uniform_int_distribution<int> weight(0, 5);
+        std::uniform_int_distribution<int> level(1, 300);
+        for (int i = 0; i < 200000; ++i) {
+            AttributeInput input;
+            input.level = static_cast<std::uint16_t>(level(random));
+            for (auto& w : input.weights) {
+                w = static_cast<std::uint8_t>(weight(random));
+            }
+            input.offsets = {i % 7, i % 11, i % 13};
+            input.raceStartingValues = {50.0f, 50.0f, 50.0f};
+            auto attributes = CalculateAttributes(input, gameConstants);
+
+            std::array<std::int64_t, numAttributes> points;
+            for (std::size_t a = 0; a < numAttributes; ++a) {
+                points[a] = attributes[a] - input.offsets[a] - 50;
+            }
+            points[0] -= (input.level - 1) * gameConstants.healthLevelBonus;
+            auto weights = input.weights[0] + input.weights[1] + input.weights[2];
+            auto totalPoints = weights > 0 ? gameConstants.attributesPerLevelUp * (input.level - 1) : 0;
+            std::int64_t total = 0;
+            for (std::size_t a = 0; a < numAttributes; ++a) {
+                EREZ_CHECK(points[a] >= 0);
+                EREZ_CHECK(input.weights[a] > 0 || points[a] == 0);
+                if (weights > 0) {
+                    EREZ_CHECK(std::abs(points[a] - 1.0 * totalPoints * input.weights[a] / weights) < 2.0);
+                }
+                total += points[a];
+            }
+            EREZ_CHECK(total == totalPoints);
+        }
+    }
+
+    // Points handed out by CalculateSkills while no skill reaches 100: the skill total is the base of every skill, the
+    // racial boosts and all skill points of the level. Skills without weight keep their starting value
+    void CheckSkillProperties() {
+        std::mt19937 random(14);
+        std::uniform_int_distribution<int> weight(0, 6);
+        std::uniform_int_distribution<int> level(1, 120);
+        std::uniform_int_distribution<int> race(0, static_cast<int>(numSkills) - 1);
+        int checked = 0;
+        for (int i = 0; i < 200000; ++i) {
+            SkillInput input;
+            input.level = static_cast<std::uint16_t>(level(random));
+            input.raceBoosts = MakeRace(race(random));
+            for (auto& w : input.weights) {
+                w = static_cast<std::uint8_t>(weight(random) <= 2 ? 0 : weight(random));
+            }
+            input.weights[i % numSkills] = 1;
+            auto skills = CalculateSkills(input, gameConstants);
+
+            std::array<int, numSkills> start;
+            start.fill(gameConstants.skillsBase);
+            for (const auto& boost : input.raceBoosts) {
+                start[boost.skill - firstSkillActorValue] += boost.bonus;
+            }
+            int total = 0;
+            int startTotal = 0;
+            bool capped = false;
+            for (std::size_t s = 0; s < numSkills; ++s) {
+                EREZ_CHECK(skills[s] >= start[s]);
+                EREZ_CHECK(input.weights[s] > 0 || skills[s] == start[s]);
+                total += skills[s];
+                startTotal += start[s];
+                capped = capped || skills[s] >= 100;
+            }
+            if (!capped) {
+                EREZ_CHECK(total == startTotal + gameConstants.skillsPerLevelUp * (input.level - 1));
+                ++checked;
+            }
+        }
+        // most inputs stay below 100
+        EREZ_CHECK(checked > 100000);
+    }
+
+    int skillMismatches = 0;
+
+    void CompareSkills(const SkillInput& input, const StatConstants& constants) {
+        auto expected = Test::ReferenceSkills(input, constants);
+        auto actual = CalculateSkills(input, constants);
+        if (expected != actual) {
+            if (++skillMismatches <= 5) {
+                std::fprintf(stderr, "CalculateSkills differs from the reference at level %d\n", input.level);
+            }
+            EREZ_CHECK(expected == actual);
+        }
+    }
+
+    // Compares CalculateSkills with the list based reference for levels 1-100 over families of class weights: single
+    // skills, all pairs of skills, equal weights, which produce the most ties, and random weights
+    void CheckSkillsMatchReference() {
+        std::array<std::array<SkillBoost, numSkillBoosts>, 3> races = {
+            std::array<SkillBoost, numSkillBoosts>{}, MakeRace(0), MakeRace(7)};
+        std::array<StatConstants, 2> constants = {gameConstants, StatConstants{10, 5, 3, 20}};
+        auto compareLevels = [&](SkillInput& input) {
+            for (const auto& race : races) {
+                input.raceBoosts = race;
+                for (const auto& c : constants) {
+                    for (std::uint16_t level = 1; level <= 100; ++level) {
+                        input.level = level;
+                        CompareSkills(input, c);
+                    }
+                }
+            }
+        };
+
+        SkillInput input;
+        for (std::size_t skill = 0; skill < numSkills; ++skill) {
+            for (int weight : {1, 2, 3, 7, 255}) {
+                input.weights = {};
+                input.weights[skill] = static_cast<std::uint8_t>(weight);
+                compareLevels(input);
+            }
+        }
+        for (std::size_t first = 0; first < numSkills; ++first) {
+            for (std::size_t second = first + 1; second < numSkills; ++second) {
+                for (int weight = 1; weight <= 4; ++weight) {
+                    input.weights = {};
+                    input.weights[first] = 1;
+                    input.weights[second] = static_cast<std::uint8_t>(weight);
+                    compareLevels(input);
+                }
+            }
+        }
+        for (std::size_t count = 1; count <= numSkills; ++count) {
+            for (int weight : {1, 2, 5}) {
+                input.weights = {};
+                for (std::size_t skill = 0; skill < count; ++skill) {
+                    input.weights[(skill * 7) % numSkills] = static_cast<std::uint8_t>(weight);
+                }
+                compareLevels(input);
+            }
+        }
+        std::mt19937 random(8);
+        std::uniform_int_distribution<int> weight(0, 6);
+        for (int i = 0; i < 400; ++i) {
+            for (auto& w : input.weights) {
+                w = static_cast<std::uint8_t>(weight(random) <= 2 ? 0 : weight(random));
+            }
+            compareLevels(input);
+        }
+    }
+}  // namespace
+
+int main() {
+    CheckLevelRangeProperties();
+    CheckLevelRangesMatchScalar();
+    CheckAttributeProperties();
+    CheckSkillProperties();
+    CheckAttributesMatchReference();
+    CheckSkillsMatchReference();
+    return EREZ::Test::Result();
+}
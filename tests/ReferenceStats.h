@@ -0,0 +1,145 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <list>
+#include <utility>
+#include <vector>
+
+#include "LevelMath.h"
+
+namespace EREZ::Test {
+    // The attribute calculation as RecalculateAttributes did it before the allocation free rewrite
+    inline std::array<std::int64_t, numAttributes> ReferenceAttributes(const AttributeInput& input,
+                                                                       const StatConstants& constants) {
+        std::array<std::int64_t, 3> attributeValues = {};
+
+        auto level = input.level;
+        auto healthWeight = input.weights[0];
+        auto magickaWeight = input.weights[1];
+        auto staminaWeight = input.weights[2];
+        auto totalWeight = healthWeight + magickaWeight + staminaWeight;
+
+        std::list<std::pair<int, int>> attributeIndices;
+        attributeIndices.push_back(std::make_pair(0, healthWeight));
+        attributeIndices.push_back(std::make_pair(1, magickaWeight));
+        attributeIndices.push_back(std::make_pair(2, staminaWeight));
+
+        attributeIndices.sort([&](const std::pair<int, int>& first, const std::pair<int, int>& second) {
+            auto comp = first.second - second.second;
+            if (comp != 0) {
+                return comp > 0;
+            }
+            return (first.first - second.first) < 0;
+        });
+
+        auto totalAttributePoints = constants.attributesPerLevelUp * (level - 1);
+        for (auto& pair : attributeIndices) {
+            auto index = pair.first;
+            auto weight = pair.second;
+            auto add = static_cast<std::int64_t>((1.0 * weight) / totalWeight * totalAttributePoints);
+            attributeValues[index] = add;
+            totalAttributePoints -= add;
+            totalWeight -= weight;
+        }
+
+        attributeValues[0] +=
+            input.offsets[0] + input.raceStartingValues[0] + (level - 1) * constants.healthLevelBonus;
+        attributeValues[1] += input.offsets[1] + input.raceStartingValues[1];
+        attributeValues[2] += input.offsets[2] + input.raceStartingValues[2];
+
+        attributeValues[0] = std::max(attributeValues[0], std::int64_t{0});
+        attributeValues[1] = std::max(attributeValues[1], std::int64_t{0});
+        attributeValues[2] = std::max(attributeValues[2], std::int64_t{0});
+
+        return attributeValues;
+    }
+
+    // The skill calculation as RecalculateStats did it before the allocation free rewrite
+    // The comparator is not a strict weak ordering: skills with equal remainder and skill level compare less in both
+    // directions, so their order depends on how std::list::sort merges
+    inline std::array<std::uint8_t, numSkills> ReferenceSkills(const SkillInput& input,
+                                                               const StatConstants& constants) {
+        auto level = input.level;
+        auto skillsBase = constants.skillsBase;
+        auto skillsPerLevelUp = constants.skillsPerLevelUp;
+        const auto* skillWeights = input.weights.data();
+
+        std::uint32_t totalSkillWeights = 0;
+        for (std::size_t i = 0; i < 18; ++i) {
+            totalSkillWeights += skillWeights[i];
+        }
+
+        std::vector<std::uint8_t> currentSkill(18, static_cast<std::uint8_t>(skillsBase));
+        for (const auto& boost : input.raceBoosts) {
+            if (boost.bonus != 0) {
+                int index = boost.skill - 6;
+                if (index >= 0 && index < 18) {
+                    currentSkill[index] = static_cast<std::uint8_t>(skillsBase + boost.bonus);
+                }
+            }
+        }
+
+        auto totalSkillPoints = skillsPerLevelUp * (level - 1);
+        auto remainingSkillPoints = totalSkillPoints;
+        std::list<std::pair<std::size_t, double>> sortedSkills;
+
+        for (std::size_t i = 0; i < 18; ++i) {
+            if (skillWeights[i] == 0) {
+                continue;
+            }
+            auto add = 1.0 * totalSkillPoints * skillWeights[i] / totalSkillWeights;
+            auto addFloored = static_cast<int>(add);
+
+            auto addLimited = std::min(addFloored, 100 - currentSkill[i]);
+            currentSkill[i] += addLimited;
+            remainingSkillPoints -= addLimited;
+
+            if (currentSkill[i] < 100) {
+                sortedSkills.push_back(std::make_pair(i, add - addFloored));
+            } else {
+                auto over = std::lround((add - addLimited) /
+                                        (1.0 * skillsPerLevelUp * skillWeights[i] / totalSkillWeights));
+                over = std::min(3l, over);
+                remainingSkillPoints -= 4 * over - 2;
+            }
+        }
+
+        while (remainingSkillPoints > 0) {
+            sortedSkills.sort(
+                [&](const std::pair<std::size_t, double>& first, const std::pair<std::size_t, double>& second) {
+                    auto comp = first.second - second.second;
+                    if (comp != 0) {
+                        return comp > 0;
+                    }
+                    comp = currentSkill[first.first] - currentSkill[second.first];
+                    if (comp != 0) {
+                        return comp < 0;
+                    }
+                    comp = first.first - second.first;
+                    return comp > 0;
+                });
+            auto changed = false;
+            for (auto& p : sortedSkills) {
+                auto i = p.first;
+                if (currentSkill[i] < 100) {
+                    currentSkill[i]++;
+                    remainingSkillPoints--;
+                    changed = true;
+                    if (remainingSkillPoints == 0) {
+                        break;
+                    }
+                }
+            }
+            if (!changed) {
+                break;
+            }
+        }
+
+        std::array<std::uint8_t, numSkills> result;
+        std::copy(currentSkill.begin(), currentSkill.end(), result.begin());
+        return result;
+    }
+}  // namespace EREZ::Test
@@ -0,0 +1,155 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <vector>
+
+#include "LevelMath.h"
+#include "TraceFormat.h"
+
+// Replays a captured trace through the leveling math and prints the time per call and a checksum
+// Usage: TraceReplay <trace file> [iterations]
+namespace {
+    using namespace EREZ;
+
+    struct Workload {
+        StatConstants constants;
+        std::vector<EREZ::Trace::RelevelRecord> relevels;
+        std::vector<EREZ::Trace::AttributeRecord> attributes;
+        std::vector<EREZ::Trace::SkillRecord> skills;
+    };
+
+    template <typename T>
+    bool ReadRecord(std::ifstream& in, std::vector<T>& records) {
+        T record;
+        if (!in.read(reinterpret_cast<char*>(&record), sizeof(record))) {
+            return false;
+        }
+        records.push_back(record);
+        return true;
+    }
+
+    bool ReadTrace(const char* path, Workload& trace) {
+        std::ifstream in(path, std::ios::binary);
+        EREZ::Trace::FileHeader header;
+        if (!in.read(reinterpret_cast<char*>(&header), sizeof(header))) {
+            std::fprintf(stderr, "Cannot read %s.\n", path);
+            return false;
+        }
+        if (header.magic != EREZ::Trace::magic || header.version != EREZ::Trace::version) {
+            std::fprintf(stderr, "%s is not a trace file of version %u.\n", path, EREZ::Trace::version);
+            return false;
+        }
+        char type;
+        while (in.get(type)) {
+            bool ok = false;
+            switch (static_cast<EREZ::Trace::RecordType>(type)) {
+                case EREZ::Trace::RecordType::kConstants:
+                    ok = static_cast<bool>(in.read(reinterpret_cast<char*>(&trace.constants), sizeof(StatConstants)));
+                    break;
+                case EREZ::Trace::RecordType::kRelevel:
+                    ok = ReadRecord(in, trace.relevels);
+                    break;
+                case EREZ::Trace::RecordType::kAttributes:
+                    ok = ReadRecord(in, trace.attributes);
+                    break;
+                case EREZ::Trace::RecordType::kSkills:
+                    ok = ReadRecord(in, trace.skills);
+                    break;
+            }
+            if (!ok) {
+                std::fprintf(stderr, "Trace is truncated or contains an unknown record type %d.\n", type);
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // batch calculation over the relevel records, grouped by the level settings
+    void RunBatch(const std::vector<EREZ::Trace::RelevelRecord>& records, int iterations) {
+        if (records.empty()) {
+            return;
+        }
+        std::uint64_t checksum = 0;
+        std::int64_t nanoseconds = 0;
+        for (int flags = 0; flags < 4; ++flags) {
+            std::vector<std::uint16_t> minLevel, maxLevel, originalMin, originalMax, level;
+            for (const auto& record : records) {
+                if (record.input.includeLevelMult == bool(flags & 1) && record.input.extendLevels == bool(flags & 2)) {
+                    minLevel.push_back(record.input.minLevel);
+                    maxLevel.push_back(record.input.maxLevel);
+                    originalMin.push_back(record.input.originalMin);
+                    originalMax.push_back(record.input.originalMax);
+                    level.push_back(record.input.level);
+                }
+            }
+            LevelRangeBatch batch{minLevel.data(), maxLevel.data(), originalMin.data(), originalMax.data(),
+                                  level.data(),    minLevel.size(), bool(flags & 1),    bool(flags & 2)};
+            std::vector<std::uint16_t> outMin(batch.count), outMax(batch.count);
+            auto start = std::chrono::steady_clock::now();
+            for (int i = 0; i < iterations; ++i) {
+                ComputeLevelRanges(batch, outMin.data(), outMax.data());
+            }
+            nanoseconds +=
+                std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+            for (std::size_t i = 0; i < batch.count; ++i) {
+                checksum = checksum * 31 + (static_cast<std::uint64_t>(outMin[i]) << 16 | outMax[i]);
+            }
+        }
+        auto calls = static_cast<double>(records.size()) * iterations;
+        std::printf("%-12s %10zu records %10.1f ns per call   checksum %016llx\n", "batch", records.size(),
+                    nanoseconds / calls, static_cast<unsigned long long>(checksum));
+    }
+
+    template <typename Records, typename Func>
+    void Run(const char* name, const Records& records, int iterations, Func&& func) {
+        if (records.empty()) {
+            return;
+        }
+        std::uint64_t checksum = 0;
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < iterations; ++i) {
+            for (const auto& record : records) {
+                checksum = checksum * 31 + func(record);
+            }
+        }
+        auto nanoseconds =
+            std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+        auto calls = static_cast<double>(records.size()) * iterations;
+        std::printf("%-12s %10zu records %10.1f ns per call   checksum %016llx\n", name, records.size(),
+                    nanoseconds / calls, static_cast<unsigned long long>(checksum));
+    }
+}  // namespace
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        std::fprintf(stderr, "Usage: %s <trace file> [iterations]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    Workload trace;
+    if (!ReadTrace(argv[1], trace)) {
+        return EXIT_FAILURE;
+    }
+    int iterations = argc > 2 ? std::max(std::atoi(argv[2]), 1) : 1;
+
+    Run("relevel", trace.relevels, iterations, [](const EREZ::Trace::RelevelRecord& record) {
+        auto range = ComputeLevelRange(record.input);
+        return static_cast<std::uint64_t>(range.min) << 16 | range.max;
+    });
+    RunBatch(trace.relevels, iterations);
+    Run("attributes", trace.attributes, iterations, [&](const EREZ::Trace::AttributeRecord& record) {
+        auto values = CalculateAttributes(record.input, trace.constants);
+        return static_cast<std::uint64_t>(values[0] ^ values[1] << 16 ^ values[2] << 32);
+    });
+    Run("skills", trace.skills, iterations, [&](const EREZ::Trace::SkillRecord& record) {
+        auto values = CalculateSkills(record.input, trace.constants);
+        std::uint64_t result = 0;
+        for (auto value : values) {
+            result = result * 131 + value;
+        }
+        return result;
+    });
+    return EXIT_SUCCESS;
+}